@@ -13,6 +13,9 @@ typedef struct opt{
 	int effort;
 	int threads;
 	int entropy;
+	int level;
+	int chunk;
+	int strip;
 	int iterations;
 	int verbosity;
 	int warmup;
@@ -21,6 +24,7 @@ typedef struct opt{
 	int encode;
 	int decode;
 	int recurse;
+	int branches;
 	int _mode;
 } opt_t;
 
@@ -45,6 +49,9 @@ int opt_init(opt_t *opt){
 	opt->effort=1;
 	opt->threads=1;
 	opt->entropy=0;
+	opt->level=0;
+	opt->chunk=0;
+	opt->strip=0;
 	opt->iterations=1;
 	opt->verbosity=1;
 	opt->warmup=1;
@@ -53,6 +60,7 @@ int opt_init(opt_t *opt){
 	opt->encode=1;
 	opt->decode=1;
 	opt->recurse=1;
+	opt->branches=0;
 	opt->custom=NULL;
 	opt->directory=NULL;
 	return 0;
@@ -105,6 +113,26 @@ int opt_process(opt_t *opt, int argc, char *argv[]){
 			}
 			++loc;
 		}
+		else if(strcmp("-level", argv[loc])==0){
+			opt->level=atoi(argv[loc+1]);
+			++loc;
+		}
+		else if(strcmp("-chunk", argv[loc])==0){
+			opt->chunk=atoi(argv[loc+1]);
+			if(opt->chunk<0){
+				fprintf(stderr, "Error, -chunk value must be at least 0\n");
+				return 1;
+			}
+			++loc;
+		}
+		else if(strcmp("-strip", argv[loc])==0){
+			opt->strip=atoi(argv[loc+1]);
+			if(opt->strip<0){
+				fprintf(stderr, "Error, -strip value must be at least 0\n");
+				return 1;
+			}
+			++loc;
+		}
 		else if(strcmp("-iterations", argv[loc])==0){
 			opt->iterations=atoi(argv[loc+1]);
 			if(opt->iterations<0){
@@ -145,6 +173,10 @@ int opt_process(opt_t *opt, int argc, char *argv[]){
 			opt->recurse=1;
 		else if(strcmp("-no-recurse", argv[loc])==0)
 			opt->recurse=0;
+		else if(strcmp("-branches", argv[loc])==0)
+			opt->branches=1;
+		else if(strcmp("-no-branches", argv[loc])==0)
+			opt->branches=0;
 		else if(strcmp("-license", argv[loc])==0){
 			if(modeset){
 				fprintf(stderr, "Error, multiple modes defined\n");
@@ -215,6 +247,12 @@ int optmode_help(){
 	printf("    Number of threads to use. Default 1\n\n");
 	printf(" -entropy input\n");
 	printf("    Entropy coder to use. 0=none, 1=LZ4, 2=ZSTD (default 0)\n\n");
+	printf(" -level input\n");
+	printf("    Entropy coder level, 0=default (ZSTD 19, LZ4 fast). ZSTD levels as is, negative for faster modes. LZ4 >0 for HC levels, <0 for acceleration\n\n");
+	printf(" -chunk input\n");
+	printf("    Bitstream bytes per independently entropy coded chunk, decoded in parallel. 0=one piece (default 0)\n\n");
+	printf(" -strip input\n");
+	printf("    Rows per independently coded strip, allowing parallel encode/decode. 0=single bitstream (default 0)\n\n");
 	printf(" -iterations input\n");
 	printf("    Number of iterations to try, default 1.\n\n");
 	printf(" -verbosity input\n");
@@ -237,6 +275,9 @@ int optmode_help(){
 	printf(" -recurse\n");
 	printf(" -no-recurse\n");
 	printf("    Descend into directories (default true)\n");
+	printf(" -branches\n");
+	printf(" -no-branches\n");
+	printf("    Count branch misses of the qoip decoder, Linux only (default false)\n");
 
 	return 0;
 }
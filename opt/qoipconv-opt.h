@@ -11,9 +11,13 @@ typedef struct opt{
 	char *custom;
 	char *in;
 	char *out;
+	char *dictionary;
 	int effort;
 	int threads;
 	int entropy;
+	int level;
+	int chunk;
+	int strip;
 	int _mode;
 } opt_t;
 
@@ -38,9 +42,13 @@ int opt_init(opt_t *opt){
 	opt->effort=1;
 	opt->threads=1;
 	opt->entropy=0;
+	opt->level=0;
+	opt->chunk=0;
+	opt->strip=0;
 	opt->custom=NULL;
 	opt->in=NULL;
 	opt->out=NULL;
+	opt->dictionary=NULL;
 	return 0;
 }
 
@@ -59,6 +67,10 @@ int opt_process(opt_t *opt, int argc, char *argv[]){
 				opt->out=argv[loc+1];
 				++loc;
 		}
+		else if(strcmp("-dictionary", argv[loc])==0){
+				opt->dictionary=argv[loc+1];
+				++loc;
+		}
 		else if(strcmp("-effort", argv[loc])==0){
 			opt->effort=atoi(argv[loc+1]);
 			if(opt->effort<-1){
@@ -89,8 +101,28 @@ int opt_process(opt_t *opt, int argc, char *argv[]){
 				fprintf(stderr, "Error, -entropy value must be at least 0\n");
 				return 1;
 			}
-			else if(opt->entropy>2){
-				fprintf(stderr, "Error, -entropy value must be at most 2\n");
+			else if(opt->entropy>3){
+				fprintf(stderr, "Error, -entropy value must be at most 3\n");
+				return 1;
+			}
+			++loc;
+		}
+		else if(strcmp("-level", argv[loc])==0){
+			opt->level=atoi(argv[loc+1]);
+			++loc;
+		}
+		else if(strcmp("-chunk", argv[loc])==0){
+			opt->chunk=atoi(argv[loc+1]);
+			if(opt->chunk<0){
+				fprintf(stderr, "Error, -chunk value must be at least 0\n");
+				return 1;
+			}
+			++loc;
+		}
+		else if(strcmp("-strip", argv[loc])==0){
+			opt->strip=atoi(argv[loc+1]);
+			if(opt->strip<0){
+				fprintf(stderr, "Error, -strip value must be at least 0\n");
 				return 1;
 			}
 			++loc;
@@ -161,12 +193,20 @@ int optmode_help(){
 	printf("    Input path\n\n");
 	printf(" -out input\n");
 	printf("    Output path\n\n");
+	printf(" -dictionary input\n");
+	printf("    ZSTD dictionary file for entropy 3 and for decoding files that use it\n\n");
 	printf(" -effort input\n");
 	printf("    Combination preset 0-6, higher tries more combinations, default 1.\n\n");
 	printf(" -threads input\n");
 	printf("    Number of threads to use. Default 1\n\n");
 	printf(" -entropy input\n");
-	printf("    Entropy coder to use. 0=none, 1=LZ4, 2=ZSTD (default 0)\n\n");
+	printf("    Entropy coder to use. 0=none, 1=LZ4, 2=ZSTD, 3=ZSTD with dictionary (default 0)\n\n");
+	printf(" -level input\n");
+	printf("    Entropy coder level, 0=default (ZSTD 19, LZ4 fast). ZSTD levels as is, negative for faster modes. LZ4 >0 for HC levels, <0 for acceleration\n\n");
+	printf(" -chunk input\n");
+	printf("    Bitstream bytes per independently entropy coded chunk, decoded in parallel. 0=one piece (default 0)\n\n");
+	printf(" -strip input\n");
+	printf("    Rows per independently coded strip, allowing parallel encode/decode. 0=single bitstream (default 0)\n\n");
 
 	return 0;
 }
@@ -6,6 +6,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define OPT_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 typedef struct opt{
 	size_t in_len;
@@ -15,6 +22,8 @@ typedef struct opt{
 	int effort;
 	int threads;
 	int entropy;
+	int level;
+	int chunk;
 	int _mode;
 } opt_t;
 
@@ -38,6 +47,22 @@ int optmode_list(opt_t *opt);
 static inline int opt_fread_fully(char **dest, size_t *dest_len, char *path){
 	FILE *io;
 	long tell;
+#ifdef OPT_MMAP
+	/*Map read-only data in place of a copy, falling back to fread*/
+	int fd;
+	struct stat st;
+	void *map;
+	if((fd=open(path, O_RDONLY))!=-1){
+		if(fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0 &&
+				(map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))!=MAP_FAILED){
+			close(fd);
+			*dest=map;
+			*dest_len=st.st_size;
+			return 0;
+		}
+		close(fd);
+	}
+#endif
 	if((io=fopen(path, "rb"))==NULL){
 		perror("Error, 'data' fopen failed");
 		return 1;
@@ -70,6 +95,8 @@ int opt_init(opt_t *opt){
 	opt->effort=1;
 	opt->threads=1;
 	opt->entropy=0;
+	opt->level=0;
+	opt->chunk=0;
 	opt->custom=NULL;
 	opt->in=NULL;
 	opt->in_len=0;
@@ -135,6 +162,18 @@ int opt_process(opt_t *opt, int argc, char *argv[]){
 			}
 			++loc;
 		}
+		else if(strcmp("-level", argv[loc])==0){
+			opt->level=atoi(argv[loc+1]);
+			++loc;
+		}
+		else if(strcmp("-chunk", argv[loc])==0){
+			opt->chunk=atoi(argv[loc+1]);
+			if(opt->chunk<0){
+				fprintf(stderr, "Error, -chunk value must be at least 0\n");
+				return 1;
+			}
+			++loc;
+		}
 		else if(strcmp("-license", argv[loc])==0){
 			if(modeset){
 				fprintf(stderr, "Error, multiple modes defined\n");
@@ -223,6 +262,10 @@ int optmode_help(){
 	printf("    Number of threads to use. Default 1\n\n");
 	printf(" -entropy input\n");
 	printf("    Entropy coder to use. 0=none, 1=LZ4, 2=ZSTD (default 0)\n\n");
+	printf(" -level input\n");
+	printf("    Entropy coder level, 0=default (ZSTD 19, LZ4 fast). ZSTD levels as is, negative for faster modes. LZ4 >0 for HC levels, <0 for acceleration\n\n");
+	printf(" -chunk input\n");
+	printf("    Bitstream bytes per independently entropy coded chunk, decoded in parallel. 0=one piece (default 0)\n\n");
 
 	return 0;
 }
@@ -6,6 +6,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define OPT_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 typedef struct opt{
 	size_t in_len;
@@ -33,6 +40,22 @@ int optmode_list(opt_t *opt);
 static inline int opt_fread_fully(char **dest, size_t *dest_len, char *path){
 	FILE *io;
 	long tell;
+#ifdef OPT_MMAP
+	/*Map read-only data in place of a copy, falling back to fread*/
+	int fd;
+	struct stat st;
+	void *map;
+	if((fd=open(path, O_RDONLY))!=-1){
+		if(fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0 &&
+				(map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))!=MAP_FAILED){
+			close(fd);
+			*dest=map;
+			*dest_len=st.st_size;
+			return 0;
+		}
+		close(fd);
+	}
+#endif
 	if((io=fopen(path, "rb"))==NULL){
 		perror("Error, 'data' fopen failed");
 		return 1;
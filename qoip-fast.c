@@ -21,7 +21,8 @@ SOFTWARE.
 
 * Encode and decode functions start processing pixels immediately, header and
   state handling has been dealt with
-* Footer needs to be written by the encode functions
+* The ending run and footer are written by the caller, so the same functions can
+  encode a whole image or a single strip
 */
 
 enum{QOIP_MASK_1=0x80, QOIP_MASK_2=0xc0, QOIP_MASK_3=0xe0, QOIP_MASK_4=0xf0, QOIP_MASK_5=0xf8, QOIP_MASK_6=0xfc, QOIP_MASK_7=0xfe};
@@ -29,7 +30,7 @@ enum{QOIP_MASK_1=0x80, QOIP_MASK_2=0xc0, QOIP_MASK_3=0xe0, QOIP_MASK_4=0xf0, QOI
 /* -effort 0 */
 enum{E0_LUMA1_232B=0x00, E0_LUMA2_464=0x80, E0_INDEX5=0xc0, E0_LUMA3_676=0xe0, E0_INDEX10=0xe8, E0_LUMA4_6866=0xec, E0_LUMA2_2322=0xf0, E0_LUMA3_4544=0xf2, E0_A=0xf4, E0_RGB=0xf5, E0_RGBA=0xf6, E0_RUN2=0xf7, E0_RUN1=0xf8};
 
-int qoip_encode_effort0(qoip_working_t *q, size_t *out_len, void *scratch, int entropy) {
+int qoip_encode_effort0(qoip_working_t *q) {
 	int index_pos;
 	if(q->channels==4) {
 		for(q->px_h=0;q->px_h<q->height;++q->px_h) {
@@ -39,7 +40,7 @@ int qoip_encode_effort0(qoip_working_t *q, size_t *out_len, void *scratch, int e
 
 				/*Run*/
 				if (q->px.v == q->px_prev.v) {
-					++q->run;
+					qoip_extend_run(q);
 					goto eop4;
 				}
 				qoip_encode_run(q);
@@ -72,76 +73,53 @@ int qoip_encode_effort0(qoip_working_t *q, size_t *out_len, void *scratch, int e
 
 				/*Index2*/
 				if (q->index2[q->hash & 1023].v == q->px.v) {
-					q->out[q->p++] = E0_INDEX10 | ((q->hash & 1023) >> 8);
-					q->out[q->p++] = q->hash & 255;
+					qoip_write_op(q, (u32)E0_INDEX10 << 8 | (q->hash & 1023), 2);
 					goto eop4;
 				}
 
 				/*luma/fallback*/
 				if(q->va!=0) {
 					if ( q->vr == 0 && q->vg == 0 && q->vb == 0 ) {
-						q->out[q->p++] = E0_A;
-						q->out[q->p++] = q->px.rgba.a;
+						qoip_write_op(q, (u32)E0_A << 8 | q->px.rgba.a, 2);
 					}
 					else if ( q->va > -3 && q->va < 2 &&
 						q->avg_gr > -3 && q->avg_gr < 2 &&
 						q->avg_g  > -5 && q->avg_g  < 4 &&
 						q->avg_gb > -3 && q->avg_gb < 2 ) {
-						q->out[q->p++] = E0_LUMA2_2322 | ((q->avg_g + 4) >> 2);
-						q->out[q->p++] = ((q->avg_g + 4) & 3) << 6 | ((q->avg_gr + 2) << 4) | ((q->avg_gb + 2) << 2) | ((q->va + 2) << 0);
+						qoip_write_op(q, (u32)E0_LUMA2_2322 << 8 | (q->avg_g + 4) << 6 | (q->avg_gr + 2) << 4 | (q->avg_gb + 2) << 2 | (q->va + 2), 2);
 					}
 					else if ( q->va > -9 && q->va < 8 &&
 						q->avg_gr > -9 && q->avg_gr < 8 &&
 						q->avg_g  > -17 && q->avg_g  < 16 &&
 						q->avg_gb > -9 && q->avg_gb < 8 ) {
-						q->out[q->p++] = E0_LUMA3_4544 | ((q->avg_g + 16) >> 4);
-						q->out[q->p++] = ((q->avg_g + 16) & 15) << 4 | ((q->avg_gr + 8) << 0);
-						q->out[q->p++] = ((q->avg_gb + 8) << 4) | ((q->va + 8) << 0);
+						qoip_write_op(q, (u32)E0_LUMA3_4544 << 16 | (q->avg_g + 16) << 12 | (q->avg_gr + 8) << 8 | (q->avg_gb + 8) << 4 | (q->va + 8), 3);
 					}
 					else if ( q->va > -33 && q->va < 32 &&
 						q->avg_gr > -33 && q->avg_gr < 32 &&
 						q->avg_gb > -33 && q->avg_gb < 32 ) {
-						q->out[q->p++] = E0_LUMA4_6866 | ((q->avg_g + 128) >> 6);
-						q->out[q->p++] = ((q->avg_g + 128) & 63) << 2 | ((q->avg_gr + 32) >> 4);
-						q->out[q->p++] = (((q->avg_gr + 32) & 15) << 4) | ((q->avg_gb + 32) >> 2);
-						q->out[q->p++] = (((q->avg_gb + 32) & 3) << 6) | ((q->va + 32) << 0);
+						qoip_write_op(q, (u32)E0_LUMA4_6866 << 24 | (q->avg_g + 128) << 18 | (q->avg_gr + 32) << 12 | (q->avg_gb + 32) << 6 | (q->va + 32), 4);
 					}
 					else {
-						q->out[q->p++] = E0_RGBA;
-						q->out[q->p++] = q->px.rgba.r;
-						q->out[q->p++] = q->px.rgba.g;
-						q->out[q->p++] = q->px.rgba.b;
-						q->out[q->p++] = q->px.rgba.a;
+						qoip_write_op(q, QOIP_OP_RGBA(E0_RGBA, q->px), 5);
 					}
 				}
 				else {
 					if ( q->avg_gr > -9 && q->avg_gr < 8 &&
 						q->avg_g  > -33 && q->avg_g  < 32 &&
 						q->avg_gb > -9 && q->avg_gb < 8 ) {
-						q->out[q->p++] = E0_LUMA2_464 | ((q->avg_g + 32) << 0);
-						q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+						qoip_write_op(q, (u32)E0_LUMA2_464 << 8 | (q->avg_g + 32) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 					}
 					else if ( q->avg_gr > -33 && q->avg_gr < 32 &&
 						q->avg_g  > -65 && q->avg_g  < 64 &&
 						q->avg_gb > -33 && q->avg_gb < 32 ) {
-						q->out[q->p++] = E0_LUMA3_676 | ((q->avg_g + 64) >> 4);
-						q->out[q->p++] = ((q->avg_g + 64) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-						q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+						qoip_write_op(q, (u32)E0_LUMA3_676 << 16 | (q->avg_g + 64) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 					}
 					else {
-						q->out[q->p++] = E0_RGB;
-						q->out[q->p++] = q->px.rgba.r;
-						q->out[q->p++] = q->px.rgba.g;
-						q->out[q->p++] = q->px.rgba.b;
+						qoip_write_op(q, QOIP_OP_RGB(E0_RGB, q->px), 4);
 					}
 				}
 
 				eop4:
-				if(q->px_w<8192) {
-					q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-					q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-					q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-				}
 				q->index2[q->hash & 1023] = q->px;
 				q->px_pos +=4;
 			}
@@ -157,7 +135,7 @@ int qoip_encode_effort0(qoip_working_t *q, size_t *out_len, void *scratch, int e
 
 				/*Run*/
 				if (q->px.v == q->px_prev.v) {
-					++q->run;
+					qoip_extend_run(q);
 					goto eop3;
 				}
 				qoip_encode_run(q);
@@ -189,8 +167,7 @@ int qoip_encode_effort0(qoip_working_t *q, size_t *out_len, void *scratch, int e
 
 				/*Index2*/
 				if (q->index2[q->hash & 1023].v == q->px.v) {
-					q->out[q->p++] = E0_INDEX10 | ((q->hash & 1023) >> 8);
-					q->out[q->p++] = q->hash & 255;
+					qoip_write_op(q, (u32)E0_INDEX10 << 8 | (q->hash & 1023), 2);
 					goto eop3;
 				}
 
@@ -199,177 +176,220 @@ int qoip_encode_effort0(qoip_working_t *q, size_t *out_len, void *scratch, int e
 					if ( q->avg_gr > -9 && q->avg_gr < 8 &&
 						q->avg_g  > -33 && q->avg_g  < 32 &&
 						q->avg_gb > -9 && q->avg_gb < 8 ) {
-						q->out[q->p++] = E0_LUMA2_464 | ((q->avg_g + 32) << 0);
-						q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+						qoip_write_op(q, (u32)E0_LUMA2_464 << 8 | (q->avg_g + 32) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 					}
 					else if ( q->avg_gr > -33 && q->avg_gr < 32 &&
 						q->avg_g  > -65 && q->avg_g  < 64 &&
 						q->avg_gb > -33 && q->avg_gb < 32 ) {
-						q->out[q->p++] = E0_LUMA3_676 | ((q->avg_g + 64) >> 4);
-						q->out[q->p++] = ((q->avg_g + 64) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-						q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+						qoip_write_op(q, (u32)E0_LUMA3_676 << 16 | (q->avg_g + 64) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 					}
 					else {
-						q->out[q->p++] = E0_RGB;
-						q->out[q->p++] = q->px.rgba.r;
-						q->out[q->p++] = q->px.rgba.g;
-						q->out[q->p++] = q->px.rgba.b;
+						qoip_write_op(q, QOIP_OP_RGB(E0_RGB, q->px), 4);
 					}
 				}
 
 				eop3:
-				if(q->px_w<8192) {
-					q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-					q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-					q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-				}
 				q->index2[q->hash & 1023] = q->px;
 				q->px_pos +=3;
 			}
 		}
 	}
-	qoip_encode_run(q);
-	qoip_finish(q);
-	*out_len=q->p;
-
-	if(entropy)
-		qoip_entropy(q->out, out_len, scratch, entropy);
 	return 0;
 }
 
-static inline void qoip_decode_effort0_inner(qoip_working_t *q) {
-	int b1, b2, b3, b4, index, vg;
-	if (q->run > 0)
-		--q->run;
-	else if (q->p < q->in_tot) {
-		q->px_prev.v = q->px.v;
-		if (q->px_pos >= q->stride && q->px_w<8192) {
-			q->px_ref.rgba.r = (q->px.rgba.r + q->upcache[(q->px_w * 3) + 0] + 1) >> 1;
-			q->px_ref.rgba.g = (q->px.rgba.g + q->upcache[(q->px_w * 3) + 1] + 1) >> 1;
-			q->px_ref.rgba.b = (q->px.rgba.b + q->upcache[(q->px_w * 3) + 2] + 1) >> 1;
-		}
-		else
-			q->px_ref.v = q->px_prev.v;
-
-		b1 = q->in[q->p++];
-		if(      (b1 & QOIP_MASK_1) == E0_LUMA1_232B ) {
-			vg = ((b1 >> 4) & 7) - 4;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			if (vg < 0) {
-				q->px.rgba.r = q->px_ref.rgba.r + vg - 1 + ((b1 >> 2) & 3);
-				q->px.rgba.b = q->px_ref.rgba.b + vg - 1 +  (b1 &  3);
-			}
-			else {
-				q->px.rgba.r = q->px_ref.rgba.r + vg - 2 + ((b1 >> 2) & 3);
-				q->px.rgba.b = q->px_ref.rgba.b + vg - 2 +  (b1 &  3);
-			}
-		}
-		else if( (b1 & QOIP_MASK_2) == E0_LUMA2_464 ) {
-			b2 = q->in[q->p++];
-			vg = ((b1 >> 0) & 63) - 32;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 15) - 8;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 15) - 8;
-		}
-		else if( (b1 & QOIP_MASK_3) == E0_INDEX5 ) {
-			q->px = q->index[b1 & 31];
-		}
-		else if( (b1 & QOIP_MASK_5) == E0_LUMA3_676 ) {
-			b2 = q->in[q->p++];
-			b3 = q->in[q->p++];
-			vg = (((b1 & 7) << 4) | (b2 >> 4)) - 64;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 15) << 2) | (b3 >> 6)) - 32;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 63) - 32;
-		}
-		else if( (b1 & QOIP_MASK_6) == E0_INDEX10 ) {
-			index = (b1 & 3) << 8;
-			index |= q->in[q->p++];
-			q->px = q->index2[index];
-		}
-		else if( (b1 & QOIP_MASK_6) == E0_LUMA4_6866 ) {
-			b2 = q->in[q->p++];
-			b3 = q->in[q->p++];
-			b4 = q->in[q->p++];
-			vg = (((b1 & 3) << 6) | (b2 >> 2)) - 128;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 3) << 4) | (b3 >> 4)) - 32;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 15) << 2) | (b4 >> 6)) - 32;
-			q->px.rgba.a += ((b4 & 63) - 32);
-		}
-		else if( (b1 & QOIP_MASK_7) == E0_LUMA2_2322 ) {
-			b2 = q->in[q->p++];
-			vg = (((b1 & 1) << 2) | (b2 >> 6)) - 4;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 3) - 2;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 2) & 3) - 2;
-			q->px.rgba.a += ((b2 & 3) - 2);
-		}
-		else if( (b1 & QOIP_MASK_7) == E0_LUMA3_4544 ) {
-			b2 = q->in[q->p++];
-			b3 = q->in[q->p++];
-			vg = (((b1 & 1) << 4) | (b2 >> 4)) - 16;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 0) & 15) - 8;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 4) & 15) - 8;
-			q->px.rgba.a += ((b3 & 15) - 8);
-		}
-		else if( b1 == E0_A ) {
-			q->px.rgba.a = q->in[q->p++];
-		}
-		else if( b1 == E0_RGB ) {
-			q->px.rgba.r = q->in[q->p++];
-			q->px.rgba.g = q->in[q->p++];
-			q->px.rgba.b = q->in[q->p++];
-		}
-		else if( b1 == E0_RGBA ) {
-			q->px.rgba.r = q->in[q->p++];
-			q->px.rgba.g = q->in[q->p++];
-			q->px.rgba.b = q->in[q->p++];
-			q->px.rgba.a = q->in[q->p++];
-		}
-		else if( b1 == E0_RUN2 )
-			q->run = q->in[q->p++] + 8;
-		else
-			q->run = b1 - E0_RUN1;
-	}
-	q->index[QOIP_COLOR_HASH(q->px)  & q->index1_maxval] = q->px;
-	q->index2[QOIP_COLOR_HASH(q->px) & q->index2_maxval] = q->px;
-	if(q->px_w<8192) {
-		q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-		q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-		q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-	}
-}
+/* Classes of effort 0 ops, in the order of the first byte ranges they take */
+enum{E0C_LUMA1_232B, E0C_LUMA2_464, E0C_INDEX5, E0C_LUMA3_676, E0C_INDEX10, E0C_LUMA4_6866, E0C_LUMA2_2322, E0C_LUMA3_4544, E0C_A, E0C_RGB, E0C_RGBA, E0C_RUN2, E0C_RUN1};
+
+/* Class of an op by its first byte. One load classifies an op instead of a chain
+of mask compares, the op length is left to each op so the input position does
+not wait on the load */
+static const u8 qoip_e0_class[256] = {
+	/* 0x00-0x7f E0_LUMA1_232B */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	/* 0x80-0xbf E0_LUMA2_464 */
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+	 1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+	/* 0xc0-0xdf E0_INDEX5 */
+	 2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,
+	 2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  2,
+	/* 0xe0-0xe7 E0_LUMA3_676, 0xe8-0xeb E0_INDEX10, 0xec-0xef E0_LUMA4_6866 */
+	 3,  3,  3,  3,  3,  3,  3,  3,  4,  4,  4,  4,  5,  5,  5,  5,
+	/* E0_LUMA2_2322 x2, E0_LUMA3_4544 x2, E0_A, E0_RGB, E0_RGBA, E0_RUN2, 0xf8-0xff E0_RUN1 */
+	 6,  6,  7,  7,  8,  9, 10, 11, 12, 12, 12, 12, 12, 12, 12, 12
+};
+
+/* With GCC the class indexes a table of labels to jump to (computed goto),
+otherwise it is a switch */
+#if defined(__GNUC__)
+#define E0_OP(c) e0_##c
+#else
+#define E0_OP(c) case E0C_##c
+#endif
 
 int qoip_decode_effort0(qoip_working_t *q) {
-	if(q->channels==4) {
-		for(q->px_h=0;q->px_h<q->height;++q->px_h) {
-			for(q->px_w=0;q->px_w<q->width;++q->px_w) {
-				qoip_decode_effort0_inner(q);
-				*(qoip_rgba_t*)(q->out + q->px_pos) = q->px;
-				q->px_pos += 4;
+#if defined(__GNUC__)
+	static const void *const e0_label[] = {
+		__extension__ &&e0_LUMA1_232B, __extension__ &&e0_LUMA2_464, __extension__ &&e0_INDEX5,
+		__extension__ &&e0_LUMA3_676, __extension__ &&e0_INDEX10, __extension__ &&e0_LUMA4_6866,
+		__extension__ &&e0_LUMA2_2322, __extension__ &&e0_LUMA3_4544, __extension__ &&e0_A,
+		__extension__ &&e0_RGB, __extension__ &&e0_RGBA, __extension__ &&e0_RUN2, __extension__ &&e0_RUN1
+	};
+#endif
+	/* Kept in locals as stores to out could alias q */
+	qoip_rgba_t px = q->px, ref;
+	size_t p = q->p, px_pos = q->px_pos;
+	const size_t stride = q->stride, in_tot = q->in_tot;
+	const unsigned char *in = q->in;
+	unsigned char *out = q->out;
+	u64 v;
+	int vg;
+	for(q->px_h=0;q->px_h<q->height;++q->px_h) {
+		for(q->px_w=0;q->px_w<q->width;++q->px_w) {
+			if (q->run > 0) {
+				q->px = px;
+				q->px_pos = px_pos;
+				qoip_expand_run(q);
+				px_pos = q->px_pos;
+				goto e0_store;
 			}
-		}
-	}
-	else {
-		for(q->px_h=0;q->px_h<q->height;++q->px_h) {
-			for(q->px_w=0;q->px_w<q->width;++q->px_w) {
-				qoip_decode_effort0_inner(q);
-				q->out[q->px_pos + 0] = q->px.rgba.r;
-				q->out[q->px_pos + 1] = q->px.rgba.g;
-				q->out[q->px_pos + 2] = q->px.rgba.b;
-				q->px_pos += 3;
+			if (p >= in_tot)
+				goto e0_store;
+			if (px_pos >= stride) {
+				ref.rgba.r = (px.rgba.r + out[px_pos - stride + 0] + 1) >> 1;
+				ref.rgba.g = (px.rgba.g + out[px_pos - stride + 1] + 1) >> 1;
+				ref.rgba.b = (px.rgba.b + out[px_pos - stride + 2] + 1) >> 1;
+			}
+			else
+				ref = px;
+
+			v = qoip_peek64(in + p);
+#if defined(__GNUC__)
+			__extension__ ({ goto *e0_label[qoip_e0_class[v >> 56]]; });
+#else
+			switch(qoip_e0_class[v >> 56]) {
+#endif
+			E0_OP(LUMA1_232B):
+				p += 1;
+				vg = QOIP_BITS(v, 1, 3) - 4;
+				px.rgba.g = ref.rgba.g + vg;
+				if (vg < 0) {
+					px.rgba.r = ref.rgba.r + vg - 1 + QOIP_BITS(v, 4, 2);
+					px.rgba.b = ref.rgba.b + vg - 1 + QOIP_BITS(v, 6, 2);
+				}
+				else {
+					px.rgba.r = ref.rgba.r + vg - 2 + QOIP_BITS(v, 4, 2);
+					px.rgba.b = ref.rgba.b + vg - 2 + QOIP_BITS(v, 6, 2);
+				}
+				goto e0_index;
+			E0_OP(LUMA2_464):
+				p += 2;
+				vg = QOIP_BITS(v, 2, 6) - 32;
+				px.rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 8, 4) - 8;
+				px.rgba.g = ref.rgba.g + vg;
+				px.rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 12, 4) - 8;
+				goto e0_index;
+			E0_OP(INDEX5):
+				p += 1;
+				px = q->index[QOIP_BITS(v, 3, 5)];
+				goto e0_index;
+			E0_OP(LUMA3_676):
+				p += 3;
+				vg = QOIP_BITS(v, 5, 7) - 64;
+				px.rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 12, 6) - 32;
+				px.rgba.g = ref.rgba.g + vg;
+				px.rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 18, 6) - 32;
+				goto e0_index;
+			E0_OP(INDEX10):
+				p += 2;
+				px = q->index2[QOIP_BITS(v, 6, 10)];
+				goto e0_index;
+			E0_OP(LUMA4_6866):
+				p += 4;
+				vg = QOIP_BITS(v, 6, 8) - 128;
+				px.rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 14, 6) - 32;
+				px.rgba.g = ref.rgba.g + vg;
+				px.rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 20, 6) - 32;
+				px.rgba.a += QOIP_BITS(v, 26, 6) - 32;
+				goto e0_index;
+			E0_OP(LUMA2_2322):
+				p += 2;
+				vg = QOIP_BITS(v, 7, 3) - 4;
+				px.rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 10, 2) - 2;
+				px.rgba.g = ref.rgba.g + vg;
+				px.rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 12, 2) - 2;
+				px.rgba.a += QOIP_BITS(v, 14, 2) - 2;
+				goto e0_index;
+			E0_OP(LUMA3_4544):
+				p += 3;
+				vg = QOIP_BITS(v, 7, 5) - 16;
+				px.rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 12, 4) - 8;
+				px.rgba.g = ref.rgba.g + vg;
+				px.rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 16, 4) - 8;
+				px.rgba.a += QOIP_BITS(v, 20, 4) - 8;
+				goto e0_index;
+			E0_OP(A):
+				p += 2;
+				px.rgba.a = QOIP_BITS(v, 8, 8);
+				goto e0_index;
+			E0_OP(RGB):
+				p += 4;
+				px.rgba.r = QOIP_BITS(v, 8, 8);
+				px.rgba.g = QOIP_BITS(v, 16, 8);
+				px.rgba.b = QOIP_BITS(v, 24, 8);
+				goto e0_index;
+			E0_OP(RGBA):
+				p += 5;
+				px.rgba.r = QOIP_BITS(v, 8, 8);
+				px.rgba.g = QOIP_BITS(v, 16, 8);
+				px.rgba.b = QOIP_BITS(v, 24, 8);
+				px.rgba.a = QOIP_BITS(v, 32, 8);
+				goto e0_index;
+			E0_OP(RUN2):
+				p += 2;
+				q->run = QOIP_BITS(v, 8, 8) + 8;
+				goto e0_index;
+			E0_OP(RUN1):
+				p += 1;
+				q->run = (int)(v >> 56) - E0_RUN1;
+				goto e0_index;
+#if !defined(__GNUC__)
 			}
+#endif
+			e0_index:
+			q->index[QOIP_COLOR_HASH(px)  & q->index1_maxval] = px;
+			q->index2[QOIP_COLOR_HASH(px) & q->index2_maxval] = px;
+			e0_store:
+			if(q->channels==4)
+				*(qoip_rgba_t*)(out + px_pos) = px;
+			else {
+				out[px_pos + 0] = px.rgba.r;
+				out[px_pos + 1] = px.rgba.g;
+				out[px_pos + 2] = px.rgba.b;
+			}
+			px_pos += q->channels;
 		}
 	}
+	q->px = px;
+	q->p = p;
+	q->px_pos = px_pos;
 	return 0;
 }
 
+#undef E0_OP
+
 /* -effort -1 */
 enum{FAST1_LUMA1_232=0x00, FAST1_LUMA2_454=0x80, FAST1_LUMA2_3433=0xa0, FAST1_LUMA3_5655=0xc0, FAST1_LUMA3_676=0xe0, FAST1_RGB=0xe8, FAST1_RGBA=0xe9, FAST1_RUN2=0xea, FAST1_RUN1=0xeb};
 
-int qoip_encode_fast1(qoip_working_t *q, size_t *out_len, void *scratch, int entropy) {
+int qoip_encode_fast1(qoip_working_t *q) {
 	if(q->channels==4) {
 		for(q->px_h=0;q->px_h<q->height;++q->px_h) {
 			for(q->px_w=0;q->px_w<q->width;++q->px_w) {
@@ -377,7 +397,7 @@ int qoip_encode_fast1(qoip_working_t *q, size_t *out_len, void *scratch, int ent
 				q->px = *(qoip_rgba_t *)(q->in + q->px_pos);
 
 				if (q->px.v == q->px_prev.v) {
-					++q->run;
+					qoip_extend_run(q);
 					goto eop4;
 				}
 				qoip_encode_run(q);
@@ -389,23 +409,16 @@ int qoip_encode_fast1(qoip_working_t *q, size_t *out_len, void *scratch, int ent
 						q->avg_gr > -5 && q->avg_gr < 4 &&
 						q->avg_g  > -9 && q->avg_g  < 8 &&
 						q->avg_gb > -5 && q->avg_gb < 4 ) {
-						q->out[q->p++] = FAST1_LUMA2_3433 | ((q->avg_g + 8) << 1) | ((q->avg_gr + 4) >> 2);
-						q->out[q->p++] = (((q->avg_gr + 4) & 3) << 6) | ((q->avg_gb + 4) << 3) | ((q->va + 4) << 0);
+						qoip_write_op(q, (u32)FAST1_LUMA2_3433 << 8 | (q->avg_g + 8) << 9 | (q->avg_gr + 4) << 6 | (q->avg_gb + 4) << 3 | (q->va + 4), 2);
 					}
 					else if ( q->va > -17 && q->va < 16 &&
 						q->avg_gr > -17 && q->avg_gr < 16 &&
 						q->avg_g  > -33 && q->avg_g  < 32 &&
 						q->avg_gb > -17 && q->avg_gb < 16 ) {
-						q->out[q->p++] = FAST1_LUMA3_5655 | ((q->avg_g + 32) >> 1);
-						q->out[q->p++] = ((q->avg_g + 32) & 1) << 7 | ((q->avg_gr + 16) << 2) | ((q->avg_gb + 16) >> 3);
-						q->out[q->p++] = (((q->avg_gb + 16) & 7) << 5) | ((q->va + 16) << 0);
+						qoip_write_op(q, (u32)FAST1_LUMA3_5655 << 16 | (q->avg_g + 32) << 15 | (q->avg_gr + 16) << 10 | (q->avg_gb + 16) << 5 | (q->va + 16), 3);
 					}
 					else {
-						q->out[q->p++] = FAST1_RGBA;
-						q->out[q->p++] = q->px.rgba.r;
-						q->out[q->p++] = q->px.rgba.g;
-						q->out[q->p++] = q->px.rgba.b;
-						q->out[q->p++] = q->px.rgba.a;
+						qoip_write_op(q, QOIP_OP_RGBA(FAST1_RGBA, q->px), 5);
 					}
 				}
 				else {
@@ -417,30 +430,19 @@ int qoip_encode_fast1(qoip_working_t *q, size_t *out_len, void *scratch, int ent
 					else if ( q->avg_gr > -9 && q->avg_gr < 8 &&
 						q->avg_g  > -17 && q->avg_g  < 16 &&
 						q->avg_gb > -9 && q->avg_gb < 8 ) {
-						q->out[q->p++] = FAST1_LUMA2_454 | ((q->avg_g + 16) << 0);
-						q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+						qoip_write_op(q, (u32)FAST1_LUMA2_454 << 8 | (q->avg_g + 16) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 					}
 					else if ( q->avg_gr > -33 && q->avg_gr < 32 &&
 						q->avg_g  > -65 && q->avg_g  < 64 &&
 						q->avg_gb > -33 && q->avg_gb < 32 ) {
-						q->out[q->p++] = FAST1_LUMA3_676 | ((q->avg_g + 64) >> 4);
-						q->out[q->p++] = ((q->avg_g + 64) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-						q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+						qoip_write_op(q, (u32)FAST1_LUMA3_676 << 16 | (q->avg_g + 64) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 					}
 					else {
-						q->out[q->p++] = FAST1_RGB;
-						q->out[q->p++] = q->px.rgba.r;
-						q->out[q->p++] = q->px.rgba.g;
-						q->out[q->p++] = q->px.rgba.b;
+						qoip_write_op(q, QOIP_OP_RGB(FAST1_RGB, q->px), 4);
 					}
 				}
 
 				eop4:
-				if(q->px_w<8192) {
-					q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-					q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-					q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-				}
 				q->px_pos +=4;
 			}
 		}
@@ -454,7 +456,7 @@ int qoip_encode_fast1(qoip_working_t *q, size_t *out_len, void *scratch, int ent
 				q->px.rgba.b = q->in[q->px_pos + 2];
 
 				if (q->px.v == q->px_prev.v) {
-					++q->run;
+					qoip_extend_run(q);
 					goto eop3;
 				}
 				qoip_encode_run(q);
@@ -469,139 +471,128 @@ int qoip_encode_fast1(qoip_working_t *q, size_t *out_len, void *scratch, int ent
 					else if ( q->avg_gr > -9 && q->avg_gr < 8 &&
 						q->avg_g  > -17 && q->avg_g  < 16 &&
 						q->avg_gb > -9 && q->avg_gb < 8 ) {
-						q->out[q->p++] = FAST1_LUMA2_454 | ((q->avg_g + 16) << 0);
-						q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+						qoip_write_op(q, (u32)FAST1_LUMA2_454 << 8 | (q->avg_g + 16) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 					}
 					else if ( q->avg_gr > -33 && q->avg_gr < 32 &&
 						q->avg_g  > -65 && q->avg_g  < 64 &&
 						q->avg_gb > -33 && q->avg_gb < 32 ) {
-						q->out[q->p++] = FAST1_LUMA3_676 | ((q->avg_g + 64) >> 4);
-						q->out[q->p++] = ((q->avg_g + 64) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-						q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+						qoip_write_op(q, (u32)FAST1_LUMA3_676 << 16 | (q->avg_g + 64) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 					}
 					else {
-						q->out[q->p++] = FAST1_RGB;
-						q->out[q->p++] = q->px.rgba.r;
-						q->out[q->p++] = q->px.rgba.g;
-						q->out[q->p++] = q->px.rgba.b;
+						qoip_write_op(q, QOIP_OP_RGB(FAST1_RGB, q->px), 4);
 					}
 				}
 
 				eop3:
-				if(q->px_w<8192) {
-					q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-					q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-					q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-				}
 				q->px_pos +=3;
 			}
 		}
 	}
-	qoip_encode_run(q);
-	qoip_finish(q);
-	*out_len=q->p;
-
-	if(entropy)
-		qoip_entropy(q->out, out_len, scratch, entropy);
 	return 0;
 }
 
-static inline void qoip_decode_fast1_inner(qoip_working_t *q) {
-	int b1, b2, b3, vg;
-	if (q->run > 0)
-		--q->run;
-	else if (q->p < q->in_tot) {
-		q->px_prev.v = q->px.v;
-		if (q->px_pos >= q->stride && q->px_w<8192) {
-			q->px_ref.rgba.r = (q->px.rgba.r + q->upcache[(q->px_w * 3) + 0] + 1) >> 1;
-			q->px_ref.rgba.g = (q->px.rgba.g + q->upcache[(q->px_w * 3) + 1] + 1) >> 1;
-			q->px_ref.rgba.b = (q->px.rgba.b + q->upcache[(q->px_w * 3) + 2] + 1) >> 1;
-		}
-		else
-			q->px_ref.v = q->px_prev.v;
-
-		b1 = q->in[q->p++];
-		if(      (b1 & QOIP_MASK_1) == FAST1_LUMA1_232 ) {
-			vg = ((b1 >> 4) & 7) - 4;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + ((b1 >> 2) & 3) - 2;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b1 >> 0) & 3) - 2;
-		}
-		else if( (b1 & QOIP_MASK_3) == FAST1_LUMA2_454 ) {
-			b2 = q->in[q->p++];
-			vg = ((b1 >> 0) & 31) - 16;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 15) - 8;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 15) - 8;
-		}
-		else if( (b1 & QOIP_MASK_3) == FAST1_LUMA2_3433 ) {
-			b2 = q->in[q->p++];
-			vg = ((b1 >> 1) & 15) - 8;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + (((b1 & 1) << 2) | (b2 >> 6)) - 4;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 3) & 7) - 4;
-			q->px.rgba.a += ((b2 & 7) - 4);
-		}
-		else if( (b1 & QOIP_MASK_3) == FAST1_LUMA3_5655 ) {
-			b2 = q->in[q->p++];
-			b3 = q->in[q->p++];
-			vg = (((b1 & 31) << 1) | (b2 >> 7)) - 32;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 2) & 31) - 16;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + (((b2 & 3) << 3) | (b3 >> 5)) - 16;
-			q->px.rgba.a += ((b3 & 31) - 16);
-		}
-		else if( (b1 & QOIP_MASK_5) == FAST1_LUMA3_676 ) {
-			b2 = q->in[q->p++];
-			b3 = q->in[q->p++];
-			vg = (((b1 & 7) << 4) | (b2 >> 4)) - 64;
-			q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 15) << 2) | (b3 >> 6)) - 32;
-			q->px.rgba.g = q->px_ref.rgba.g + vg;
-			q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 63) - 32;
-		}
-		else if( b1 == FAST1_RGB ) {
-			q->px.rgba.r = q->in[q->p++];
-			q->px.rgba.g = q->in[q->p++];
-			q->px.rgba.b = q->in[q->p++];
-		}
-		else if( b1 == FAST1_RGBA ) {
-			q->px.rgba.r = q->in[q->p++];
-			q->px.rgba.g = q->in[q->p++];
-			q->px.rgba.b = q->in[q->p++];
-			q->px.rgba.a = q->in[q->p++];
-		}
-		else if( b1 == FAST1_RUN2 )
-			q->run = q->in[q->p++] + 21;
-		else
-			q->run = b1 - FAST1_RUN1;
+/* Decode the op at in + *p against ref into *px */
+static inline void qoip_decode_fast1_inner(qoip_working_t *q, const unsigned char *in, size_t *p, qoip_rgba_t *px, const qoip_rgba_t ref) {
+	const u64 v = qoip_peek64(in + *p);
+	const int b1 = v >> 56;
+	int vg;
+	if(      (b1 & QOIP_MASK_1) == FAST1_LUMA1_232 ) {
+		*p += 1;
+		vg = QOIP_BITS(v, 1, 3) - 4;
+		px->rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 4, 2) - 2;
+		px->rgba.g = ref.rgba.g + vg;
+		px->rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 6, 2) - 2;
+	}
+	else if( (b1 & QOIP_MASK_3) == FAST1_LUMA2_454 ) {
+		*p += 2;
+		vg = QOIP_BITS(v, 3, 5) - 16;
+		px->rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 8, 4) - 8;
+		px->rgba.g = ref.rgba.g + vg;
+		px->rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 12, 4) - 8;
+	}
+	else if( (b1 & QOIP_MASK_3) == FAST1_LUMA2_3433 ) {
+		*p += 2;
+		vg = QOIP_BITS(v, 3, 4) - 8;
+		px->rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 7, 3) - 4;
+		px->rgba.g = ref.rgba.g + vg;
+		px->rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 10, 3) - 4;
+		px->rgba.a += QOIP_BITS(v, 13, 3) - 4;
+	}
+	else if( (b1 & QOIP_MASK_3) == FAST1_LUMA3_5655 ) {
+		*p += 3;
+		vg = QOIP_BITS(v, 3, 6) - 32;
+		px->rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 9, 5) - 16;
+		px->rgba.g = ref.rgba.g + vg;
+		px->rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 14, 5) - 16;
+		px->rgba.a += QOIP_BITS(v, 19, 5) - 16;
 	}
-	if(q->px_w<8192) {
-		q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-		q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-		q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
+	else if( (b1 & QOIP_MASK_5) == FAST1_LUMA3_676 ) {
+		*p += 3;
+		vg = QOIP_BITS(v, 5, 7) - 64;
+		px->rgba.r = ref.rgba.r + vg + QOIP_BITS(v, 12, 6) - 32;
+		px->rgba.g = ref.rgba.g + vg;
+		px->rgba.b = ref.rgba.b + vg + QOIP_BITS(v, 18, 6) - 32;
+	}
+	else if( b1 == FAST1_RGB ) {
+		*p += 4;
+		px->rgba.r = QOIP_BITS(v, 8, 8);
+		px->rgba.g = QOIP_BITS(v, 16, 8);
+		px->rgba.b = QOIP_BITS(v, 24, 8);
+	}
+	else if( b1 == FAST1_RGBA ) {
+		*p += 5;
+		px->rgba.r = QOIP_BITS(v, 8, 8);
+		px->rgba.g = QOIP_BITS(v, 16, 8);
+		px->rgba.b = QOIP_BITS(v, 24, 8);
+		px->rgba.a = QOIP_BITS(v, 32, 8);
+	}
+	else if( b1 == FAST1_RUN2 ) {
+		*p += 2;
+		q->run = QOIP_BITS(v, 8, 8) + 21;
+	}
+	else {
+		*p += 1;
+		q->run = b1 - FAST1_RUN1;
 	}
 }
 
 int qoip_decode_fast1(qoip_working_t *q) {
-	if(q->channels==4) {
-		for(q->px_h=0;q->px_h<q->height;++q->px_h) {
-			for(q->px_w=0;q->px_w<q->width;++q->px_w) {
-				qoip_decode_fast1_inner(q);
-				*(qoip_rgba_t*)(q->out + q->px_pos) = q->px;
-				q->px_pos += 4;
+	/* Kept in locals as stores to out could alias q */
+	qoip_rgba_t px = q->px, ref;
+	size_t p = q->p, px_pos = q->px_pos;
+	const size_t stride = q->stride, in_tot = q->in_tot;
+	const unsigned char *in = q->in;
+	unsigned char *out = q->out;
+	for(q->px_h=0;q->px_h<q->height;++q->px_h) {
+		for(q->px_w=0;q->px_w<q->width;++q->px_w) {
+			if (q->run > 0) {
+				q->px = px;
+				q->px_pos = px_pos;
+				qoip_expand_run(q);
+				px_pos = q->px_pos;
 			}
-		}
-	}
-	else {
-		for(q->px_h=0;q->px_h<q->height;++q->px_h) {
-			for(q->px_w=0;q->px_w<q->width;++q->px_w) {
-				qoip_decode_fast1_inner(q);
-				q->out[q->px_pos + 0] = q->px.rgba.r;
-				q->out[q->px_pos + 1] = q->px.rgba.g;
-				q->out[q->px_pos + 2] = q->px.rgba.b;
-				q->px_pos += 3;
+			else if (p < in_tot) {
+				if (px_pos >= stride) {
+					ref.rgba.r = (px.rgba.r + out[px_pos - stride + 0] + 1) >> 1;
+					ref.rgba.g = (px.rgba.g + out[px_pos - stride + 1] + 1) >> 1;
+					ref.rgba.b = (px.rgba.b + out[px_pos - stride + 2] + 1) >> 1;
+				}
+				else
+					ref = px;
+				qoip_decode_fast1_inner(q, in, &p, &px, ref);
+			}
+			if(q->channels==4)
+				*(qoip_rgba_t*)(out + px_pos) = px;
+			else {
+				out[px_pos + 0] = px.rgba.r;
+				out[px_pos + 1] = px.rgba.g;
+				out[px_pos + 2] = px.rgba.b;
 			}
+			px_pos += q->channels;
 		}
 	}
+	q->px = px;
+	q->p = p;
+	q->px_pos = px_pos;
 	return 0;
 }
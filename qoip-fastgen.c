@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: MIT */
+/* Generated by qoip-fastgen.py from qoip-fastgen.def, do not edit. Included by QOIP_C only */
+
+/* 01426265a0 */
+int qoip_encode_gen_01426265a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 2, (
+		qoip_enc_indexf(q, 0x00) ||
+		qoip_enc_delta(q, 0x80) ||
+		qoip_enc_index10(q, 0xc0) ||
+		qoip_enc_luma2_444(q, 0xb0) ||
+		qoip_enc_luma3_686(q, 0xa0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_01426265a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNERF_OPS(1,
+		if((q->in[q->p] & 0xe0) == 0x80)
+			qoip_dec_delta(q);
+		else if((q->in[q->p] & 0xf0) == 0xa0)
+			qoip_dec_luma3_686(q);
+		else if((q->in[q->p] & 0xf0) == 0xb0)
+			qoip_dec_luma2_444(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 02244162a0 */
+int qoip_encode_gen_02244162a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 2, (
+		qoip_enc_indexf(q, 0xc0) ||
+		qoip_enc_luma1_232_bias(q, 0x00) ||
+		qoip_enc_index10(q, 0xf0) ||
+		qoip_enc_luma2_464(q, 0x80) ||
+		qoip_enc_luma3_686(q, 0xe0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_02244162a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNERF_OPS(1,
+		if((q->in[q->p] & 0x80) == 0x00)
+			qoip_dec_luma1_232_bias(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma2_464(q);
+		else if((q->in[q->p] & 0xf0) == 0xe0)
+			qoip_dec_luma3_686(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 21232462a0 */
+int qoip_encode_gen_21232462a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 2, (
+		qoip_enc_indexf(q, 0x00) ||
+		qoip_enc_diff1_222(q, 0x40) ||
+		qoip_enc_index10(q, 0xd0) ||
+		qoip_enc_luma2_464(q, 0x80) ||
+		qoip_enc_luma3_686(q, 0xc0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_21232462a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNERF_OPS(1,
+		if((q->in[q->p] & 0xc0) == 0x40)
+			qoip_dec_diff1_222(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma2_464(q);
+		else if((q->in[q->p] & 0xf0) == 0xc0)
+			qoip_dec_luma3_686(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 21232482a0 */
+int qoip_encode_gen_21232482a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 2, (
+		qoip_enc_indexf(q, 0x00) ||
+		qoip_enc_diff1_222(q, 0x40) ||
+		qoip_enc_index10(q, 0xc8) ||
+		qoip_enc_luma2_464(q, 0x80) ||
+		qoip_enc_luma3_676(q, 0xc0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_21232482a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNERF_OPS(1,
+		if((q->in[q->p] & 0xc0) == 0x40)
+			qoip_dec_diff1_222(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma2_464(q);
+		else if((q->in[q->p] & 0xf8) == 0xc0)
+			qoip_dec_luma3_676(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 01254284a0 */
+int qoip_encode_gen_01254284a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 2, (
+		qoip_enc_indexf(q, 0x00) ||
+		qoip_enc_delta(q, 0xc0) ||
+		qoip_enc_index10(q, 0xe8) ||
+		qoip_enc_luma2_353(q, 0xe0) ||
+		qoip_enc_luma3_787(q, 0x80)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_01254284a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNERF_OPS(1,
+		if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma3_787(q);
+		else if((q->in[q->p] & 0xe0) == 0xc0)
+			qoip_dec_delta(q);
+		else if((q->in[q->p] & 0xf8) == 0xe0)
+			qoip_dec_luma2_353(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 00426265a0 */
+int qoip_encode_gen_00426265a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 1, (
+		qoip_enc_index(q, 0x00) ||
+		qoip_enc_delta(q, 0x80) ||
+		qoip_enc_index10(q, 0xc0) ||
+		qoip_enc_luma2_444(q, 0xb0) ||
+		qoip_enc_luma3_686(q, 0xa0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_00426265a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNER_OPS(1, 1,
+		if((q->in[q->p] & 0x80) == 0x00)
+			qoip_dec_index(q);
+		else if((q->in[q->p] & 0xe0) == 0x80)
+			qoip_dec_delta(q);
+		else if((q->in[q->p] & 0xf0) == 0xa0)
+			qoip_dec_luma3_686(q);
+		else if((q->in[q->p] & 0xf0) == 0xb0)
+			qoip_dec_luma2_444(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 20232462a0 */
+int qoip_encode_gen_20232462a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 1, (
+		qoip_enc_index(q, 0x00) ||
+		qoip_enc_diff1_222(q, 0x40) ||
+		qoip_enc_index10(q, 0xd0) ||
+		qoip_enc_luma2_464(q, 0x80) ||
+		qoip_enc_luma3_686(q, 0xc0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_20232462a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNER_OPS(1, 1,
+		if((q->in[q->p] & 0xc0) == 0x00)
+			qoip_dec_index(q);
+		else if((q->in[q->p] & 0xc0) == 0x40)
+			qoip_dec_diff1_222(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma2_464(q);
+		else if((q->in[q->p] & 0xf0) == 0xc0)
+			qoip_dec_luma3_686(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 02244062a0 */
+int qoip_encode_gen_02244062a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 1, (
+		qoip_enc_index(q, 0xc0) ||
+		qoip_enc_luma1_232_bias(q, 0x00) ||
+		qoip_enc_index10(q, 0xf0) ||
+		qoip_enc_luma2_464(q, 0x80) ||
+		qoip_enc_luma3_686(q, 0xe0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_02244062a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNER_OPS(1, 1,
+		if((q->in[q->p] & 0x80) == 0x00)
+			qoip_dec_luma1_232_bias(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma2_464(q);
+		else if((q->in[q->p] & 0xe0) == 0xc0)
+			qoip_dec_index(q);
+		else if((q->in[q->p] & 0xf0) == 0xe0)
+			qoip_dec_luma3_686(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 00254284a0 */
+int qoip_encode_gen_00254284a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 1, (
+		qoip_enc_index(q, 0x00) ||
+		qoip_enc_delta(q, 0xc0) ||
+		qoip_enc_index10(q, 0xe8) ||
+		qoip_enc_luma2_353(q, 0xe0) ||
+		qoip_enc_luma3_787(q, 0x80)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_00254284a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNER_OPS(1, 1,
+		if((q->in[q->p] & 0x80) == 0x00)
+			qoip_dec_index(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma3_787(q);
+		else if((q->in[q->p] & 0xe0) == 0xc0)
+			qoip_dec_delta(q);
+		else if((q->in[q->p] & 0xf8) == 0xe0)
+			qoip_dec_luma2_353(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+/* 20232482a0 */
+int qoip_encode_gen_20232482a0(qoip_working_t *q) {
+	QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(1, 1, (
+		qoip_enc_index(q, 0x00) ||
+		qoip_enc_diff1_222(q, 0x40) ||
+		qoip_enc_index10(q, 0xc8) ||
+		qoip_enc_luma2_464(q, 0x80) ||
+		qoip_enc_luma3_676(q, 0xc0)
+	)));
+	return 0;
+}
+
+int qoip_decode_gen_20232482a0(qoip_working_t *q) {
+	QOIP_DECODE_LOOP(QOIP_DECODE_INNER_OPS(1, 1,
+		if((q->in[q->p] & 0xc0) == 0x00)
+			qoip_dec_index(q);
+		else if((q->in[q->p] & 0xc0) == 0x40)
+			qoip_dec_diff1_222(q);
+		else if((q->in[q->p] & 0xc0) == 0x80)
+			qoip_dec_luma2_464(q);
+		else if((q->in[q->p] & 0xf8) == 0xc0)
+			qoip_dec_luma3_676(q);
+		else
+			qoip_dec_index10(q);
+	));
+	return 0;
+}
+
+#define QOIP_FASTGEN_TABLE \
+	{{5, OP_INDEX7F, OP_DELTA, OP_LUMA3_686, OP_LUMA2_444, OP_INDEX10}, qoip_encode_gen_01426265a0, qoip_decode_gen_01426265a0}, \
+	{{5, OP_LUMA1_232B, OP_LUMA2_464, OP_INDEX5F, OP_LUMA3_686, OP_INDEX10}, qoip_encode_gen_02244162a0, qoip_decode_gen_02244162a0}, \
+	{{5, OP_INDEX6F, OP_DIFF1_222, OP_LUMA2_464, OP_LUMA3_686, OP_INDEX10}, qoip_encode_gen_21232462a0, qoip_decode_gen_21232462a0}, \
+	{{5, OP_INDEX6F, OP_DIFF1_222, OP_LUMA2_464, OP_LUMA3_676, OP_INDEX10}, qoip_encode_gen_21232482a0, qoip_decode_gen_21232482a0}, \
+	{{5, OP_INDEX7F, OP_LUMA3_787, OP_DELTA, OP_LUMA2_353, OP_INDEX10}, qoip_encode_gen_01254284a0, qoip_decode_gen_01254284a0}, \
+	{{5, OP_INDEX7, OP_DELTA, OP_LUMA3_686, OP_LUMA2_444, OP_INDEX10}, qoip_encode_gen_00426265a0, qoip_decode_gen_00426265a0}, \
+	{{5, OP_INDEX6, OP_DIFF1_222, OP_LUMA2_464, OP_LUMA3_686, OP_INDEX10}, qoip_encode_gen_20232462a0, qoip_decode_gen_20232462a0}, \
+	{{5, OP_LUMA1_232B, OP_LUMA2_464, OP_INDEX5, OP_LUMA3_686, OP_INDEX10}, qoip_encode_gen_02244062a0, qoip_decode_gen_02244062a0}, \
+	{{5, OP_INDEX7, OP_LUMA3_787, OP_DELTA, OP_LUMA2_353, OP_INDEX10}, qoip_encode_gen_00254284a0, qoip_decode_gen_00254284a0}, \
+	{{5, OP_INDEX6, OP_DIFF1_222, OP_LUMA2_464, OP_LUMA3_676, OP_INDEX10}, qoip_encode_gen_20232482a0, qoip_decode_gen_20232482a0}, \
+
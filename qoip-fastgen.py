@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: MIT
+"""qoip-fastgen.py - Generate fastpath encoders/decoders for fixed opstrings
+
+Usage: qoip-fastgen.py [config] [output]
+Defaults to qoip-fastgen.def and qoip-fastgen.c next to this script.
+
+The config lists one opstring per line, '#' starts a comment. For each opstring
+an encoder and decoder are emitted that call the op functions of qoip-func.c
+directly with constant opcodes, instead of through the op table. They are built
+from the same QOIP_*_INNER_OPS macros as the generic path, so the output is
+identical. Op ids, sets and functions are read from qoip.h, so new ops need no
+changes here.
+"""
+
+import os
+import re
+import sys
+
+SETS = ["QOIP_SET_INDEX1", "QOIP_SET_LEN1", "QOIP_SET_INDEX2", "QOIP_SET_LEN2", "QOIP_SET_LEN3", "QOIP_SET_LEN4"]
+KEY_MAX = 15  # qoip_fastpath_t.opstr holds the count plus 15 ids
+
+
+def opcnt(op_id):
+	return 1 << (7 - (op_id >> 5))
+
+
+def mask(op_id):
+	return (opcnt(op_id) - 1) ^ 255
+
+
+def read_ops(header):
+	"""Return {id: (name, set, enc, dec)} parsed from the id enum and qoip_ops[]"""
+	src = open(header).read()
+	enum = re.search(r"enum\{\s*/\*MASK1\*/(.*?)OP_END", src, re.S).group(1)
+	enum = re.sub(r"/\*.*?\*/", "", enum, flags=re.S)
+	ids, val = {}, -1
+	for tok in enum.split(","):
+		tok = tok.strip()
+		if not tok:
+			continue
+		if "=" in tok:
+			name, v = tok.split("=")
+			name, val = name.strip(), int(v, 0)
+		else:
+			name, val = tok, val + 1
+		ids[name] = val
+	table = re.search(r"const opdef_t qoip_ops\[\] = \{(.*?)\n\};", src, re.S).group(1)
+	ops = {}
+	for m in re.finditer(r"\{(OP_\w+),\s*(QOIP_SET_\w+),.*?,\s*(\w+),\s*(\w+)\},", table, re.S):
+		name, opset, enc, dec = m.groups()
+		ops[ids[name]] = (name, SETS.index(opset), enc, dec)
+	return ops
+
+
+def parse_opstring(opstr, ops):
+	"""Validate like parse_opstring in qoip.h, returning ids in id order"""
+	if len(opstr) % 2:
+		raise ValueError("odd length")
+	ids = sorted(set(int(opstr[i:i+2], 16) for i in range(0, len(opstr), 2)))
+	for i in ids:
+		if i not in ops:
+			raise ValueError("invalid op id %02x" % i)
+	if sum(ops[i][1] == 0 for i in ids) > 1 or sum(ops[i][1] == 2 for i in ids) > 1:
+		raise ValueError("multiple index ops from the same set")
+	if sum(opcnt(i) for i in ids) > 253:
+		raise ValueError("too many ops")
+	if len(ids) > KEY_MAX:
+		raise ValueError("more than %d ops" % KEY_MAX)
+	return ids
+
+
+def emit(opstr, ids, ops):
+	opcode, code = 0, {}
+	for i in ids:  # Opcodes are allocated in id order, like qoip_expand_opcodes
+		code[i] = opcode
+		opcode += opcnt(i)
+	index1 = [i for i in ids if ops[i][1] == 0]
+	index2 = [i for i in ids if ops[i][1] == 2]
+	aaa = 1 if index2 else 0
+	fifo = bool(index1) and index1[0] % 32 == 1
+	bbb = (2 if fifo else 1) if index1 else 0
+	name = "gen_" + "".join("%02x" % i for i in ids)
+
+	enc_order = sorted(ids, key=lambda i: (ops[i][1], i))  # qoip_sort_set order
+	chain = " ||\n".join("\t\t%s(q, 0x%02x)" % (ops[i][2], code[i]) for i in enc_order)
+	out = ["/* %s */" % opstr]
+	out.append("int qoip_encode_%s(qoip_working_t *q) {" % name)
+	out.append("\tQOIP_ENCODE_LOOP(QOIP_ENCODE_INNER_OPS(%d, %d, (\n%s\n\t)));" % (aaa, bbb, chain))
+	out.append("\treturn 0;\n}\n")
+
+	dec = [i for i in ids if not (fifo and ops[i][1] == 0)]
+	lines = []
+	for n, i in enumerate(dec):
+		cond = "if((q->in[q->p] & 0x%02x) == 0x%02x)" % (mask(i), code[i])
+		if n == len(dec) - 1:  # Implicit ops are handled before, so the last op is the remainder
+			cond = "else" if n else ""
+		elif n:
+			cond = "else " + cond
+		lines.append("\t\t%s%s%s(q);" % (cond, "\n\t\t\t" if cond else "", ops[i][3]))
+	body = "\n".join(lines) if lines else "\t\t"
+	inner = "QOIP_DECODE_INNERF_OPS(%d," % aaa if fifo else "QOIP_DECODE_INNER_OPS(%d, %d," % (aaa, bbb)
+	out.append("int qoip_decode_%s(qoip_working_t *q) {" % name)
+	out.append("\tQOIP_DECODE_LOOP(%s\n%s\n\t));" % (inner, body))
+	out.append("\treturn 0;\n}\n")
+	key = "{{%d, %s}, qoip_encode_%s, qoip_decode_%s}" % (len(ids), ", ".join(ops[i][0] for i in ids), name, name)
+	return "\n".join(out), key
+
+
+def main():
+	here = os.path.dirname(os.path.abspath(__file__))
+	config = sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "qoip-fastgen.def")
+	output = sys.argv[2] if len(sys.argv) > 2 else os.path.join(here, "qoip-fastgen.c")
+	ops = read_ops(os.path.join(here, "qoip.h"))
+	funcs, keys, seen = [], [], set()
+	for n, line in enumerate(open(config), 1):
+		opstr = line.split("#")[0].strip()
+		if not opstr:
+			continue
+		try:
+			ids = parse_opstring(opstr, ops)
+		except ValueError as e:
+			sys.exit("%s:%d: %s: %s" % (config, n, opstr, e))
+		if tuple(ids) in seen:
+			continue
+		seen.add(tuple(ids))
+		f, k = emit(opstr, ids, ops)
+		funcs.append(f)
+		keys.append(k)
+	with open(output, "w") as o:
+		o.write("/* SPDX-License-Identifier: MIT */\n")
+		o.write("/* Generated by qoip-fastgen.py from %s, do not edit. Included by QOIP_C only */\n\n" % os.path.basename(config))
+		o.write("\n".join(funcs))
+		o.write("\n#define QOIP_FASTGEN_TABLE \\\n")
+		o.write("".join("\t%s, \\\n" % k for k in keys))
+		o.write("\n")
+
+
+if __name__ == "__main__":
+	main()
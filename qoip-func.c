@@ -53,43 +53,38 @@ int qoip_enc_indexf(qoip_working_t *q, u8 opcode) {
 
 int qoip_enc_index8(qoip_working_t *q, u8 opcode) {
 	if (q->index2[q->hash & 255].v == q->px.v) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = q->hash & 255;
+		qoip_write_op(q, (u32)opcode << 8 | (q->hash & 255), 2);
 		return 1;
 	}
 	return 0;
 }
 void qoip_dec_index8(qoip_working_t *q) {
-	++q->p;
-	q->px = q->index2[q->in[q->p++]];
+	q->px = q->index2[q->in[q->p + 1]];
+	q->p += 2;
 }
 
 int qoip_enc_index9(qoip_working_t *q, u8 opcode) {
 	if (q->index2[q->hash & 511].v == q->px.v) {
-		q->out[q->p++] = opcode | ((q->hash & 511) >> 8);
-		q->out[q->p++] = q->hash & 255;
+		qoip_write_op(q, (u32)opcode << 8 | (q->hash & 511), 2);
 		return 1;
 	}
 	return 0;
 }
 void qoip_dec_index9(qoip_working_t *q) {
-	int index = (q->in[q->p++] & 1) << 8;
-	index |= q->in[q->p++];
-	q->px = q->index2[index];
+	q->px = q->index2[QOIP_BITS(qoip_peek64(q->in + q->p), 7, 9)];
+	q->p += 2;
 }
 
 int qoip_enc_index10(qoip_working_t *q, u8 opcode) {
 	if (q->index2[q->hash & 1023].v == q->px.v) {
-		q->out[q->p++] = opcode | ((q->hash & 1023) >> 8);
-		q->out[q->p++] = q->hash & 255;
+		qoip_write_op(q, (u32)opcode << 8 | (q->hash & 1023), 2);
 		return 1;
 	}
 	return 0;
 }
 void qoip_dec_index10(qoip_working_t *q) {
-	int index = (q->in[q->p++] & 3) << 8;
-	index |= q->in[q->p++];
-	q->px = q->index2[index];
+	q->px = q->index2[QOIP_BITS(qoip_peek64(q->in + q->p), 6, 10)];
+	q->p += 2;
 }
 
 int qoip_enc_delta(qoip_working_t *q, u8 opcode) {
@@ -223,15 +218,14 @@ void qoip_dec_deltaa(qoip_working_t *q) {
 
 int qoip_enc_a(qoip_working_t *q, u8 opcode) {
 	if ( q->vr == 0 && q->vg == 0 && q->vb == 0 ) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = q->px.rgba.a;
+		qoip_write_op(q, (u32)opcode << 8 | q->px.rgba.a, 2);
 		return 1;
 	}
 	return 0;
 }
 void qoip_dec_a(qoip_working_t *q) {
-	++q->p;
-	q->px.rgba.a = q->in[q->p++];
+	q->px.rgba.a = q->in[q->p + 1];
+	q->p += 2;
 }
 
 /* Generated LUMA functions */
@@ -276,19 +270,18 @@ static inline int qoip_enc_luma2_242(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -3 && q->avg_gr < 2 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -3 && q->avg_gb < 2 ) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = ((q->avg_g + 8) << 4) | ((q->avg_gr + 2) << 2) | ((q->avg_gb + 2) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 4 | (q->avg_gr + 2) << 2 | (q->avg_gb + 2), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_242(qoip_working_t *q) {
-	++q->p;
-	int b2 = q->in[q->p++];
-	int vg = ((b2 >> 4) & 15) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 2) & 3) - 2;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 8, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 2) - 2;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 3) - 2;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 14, 2) - 2;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_333(qoip_working_t *q, u8 opcode) {
@@ -296,19 +289,18 @@ static inline int qoip_enc_luma2_333(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -5 && q->avg_g  < 4 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 4) >> 2);
-		q->out[q->p++] = ((q->avg_g + 4) & 3) << 6 | ((q->avg_gr + 4) << 3) | ((q->avg_gb + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 4) << 6 | (q->avg_gr + 4) << 3 | (q->avg_gb + 4), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_333(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = (((b1 & 1) << 2) | (b2 >> 6)) - 4;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 3) & 7) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 7, 3) - 4;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 7) - 4;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 13, 3) - 4;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_343(qoip_working_t *q, u8 opcode) {
@@ -316,19 +308,18 @@ static inline int qoip_enc_luma2_343(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 8) >> 2);
-		q->out[q->p++] = ((q->avg_g + 8) & 3) << 6 | ((q->avg_gr + 4) << 3) | ((q->avg_gb + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 6 | (q->avg_gr + 4) << 3 | (q->avg_gb + 4), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_343(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = (((b1 & 3) << 2) | (b2 >> 6)) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 3) & 7) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 6, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 7) - 4;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 13, 3) - 4;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_353(qoip_working_t *q, u8 opcode) {
@@ -336,19 +327,18 @@ static inline int qoip_enc_luma2_353(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 16) >> 2);
-		q->out[q->p++] = ((q->avg_g + 16) & 3) << 6 | ((q->avg_gr + 4) << 3) | ((q->avg_gb + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 16) << 6 | (q->avg_gr + 4) << 3 | (q->avg_gb + 4), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_353(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = (((b1 & 7) << 2) | (b2 >> 6)) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 3) & 7) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 5, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 7) - 4;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 13, 3) - 4;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_444(qoip_working_t *q, u8 opcode) {
@@ -356,19 +346,18 @@ static inline int qoip_enc_luma2_444(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 8) << 0);
-		q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_444(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 0) & 15) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 15) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 4, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 8, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 15) - 8;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 12, 4) - 8;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_454(qoip_working_t *q, u8 opcode) {
@@ -376,19 +365,18 @@ static inline int qoip_enc_luma2_454(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 16) << 0);
-		q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 16) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_454(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 0) & 31) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 15) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 3, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 8, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 15) - 8;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 12, 4) - 8;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_464(qoip_working_t *q, u8 opcode) {
@@ -396,19 +384,18 @@ static inline int qoip_enc_luma2_464(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 32) << 0);
-		q->out[q->p++] = ((q->avg_gr + 8) << 4) | ((q->avg_gb + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 32) << 8 | (q->avg_gr + 8) << 4 | (q->avg_gb + 8), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_464(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 0) & 63) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 15) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 2, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 8, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 15) - 8;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 12, 4) - 8;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_555(qoip_working_t *q, u8 opcode) {
@@ -416,19 +403,18 @@ static inline int qoip_enc_luma2_555(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 16) << 2) | ((q->avg_gr + 16) >> 3);
-		q->out[q->p++] = (((q->avg_gr + 16) & 7) << 5) | ((q->avg_gb + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 16) << 10 | (q->avg_gr + 16) << 5 | (q->avg_gb + 16), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_555(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 2) & 31) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b1 & 3) << 3) | (b2 >> 5)) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 1, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 6, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 0) & 31) - 16;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 11, 5) - 16;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma3_565(qoip_working_t *q, u8 opcode) {
@@ -436,21 +422,18 @@ static inline int qoip_enc_luma3_565(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = ((q->avg_g + 32) << 2) | ((q->avg_gr + 16) >> 3);
-		q->out[q->p++] = (((q->avg_gr + 16) & 7) << 5) | ((q->avg_gb + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 32) << 10 | (q->avg_gr + 16) << 5 | (q->avg_gb + 16), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_565(qoip_working_t *q) {
-	++q->p;
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = ((b2 >> 2) & 63) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 3) << 3) | (b3 >> 5)) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 8, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 14, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 31) - 16;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 19, 5) - 16;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_575(qoip_working_t *q, u8 opcode) {
@@ -458,21 +441,18 @@ static inline int qoip_enc_luma3_575(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 64) >> 6);
-		q->out[q->p++] = ((q->avg_g + 64) & 63) << 2 | ((q->avg_gr + 16) >> 3);
-		q->out[q->p++] = (((q->avg_gr + 16) & 7) << 5) | ((q->avg_gb + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 64) << 10 | (q->avg_gr + 16) << 5 | (q->avg_gb + 16), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_575(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 1) << 6) | (b2 >> 2)) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 3) << 3) | (b3 >> 5)) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 7, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 14, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 31) - 16;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 19, 5) - 16;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_666(qoip_working_t *q, u8 opcode) {
@@ -480,21 +460,18 @@ static inline int qoip_enc_luma3_666(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 32) >> 4);
-		q->out[q->p++] = ((q->avg_g + 32) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-		q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 32) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_666(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 3) << 4) | (b2 >> 4)) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 15) << 2) | (b3 >> 6)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 6, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 63) - 32;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 18, 6) - 32;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_676(qoip_working_t *q, u8 opcode) {
@@ -502,42 +479,36 @@ static inline int qoip_enc_luma3_676(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 64) >> 4);
-		q->out[q->p++] = ((q->avg_g + 64) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-		q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 64) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_676(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 7) << 4) | (b2 >> 4)) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 15) << 2) | (b3 >> 6)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 5, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 63) - 32;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 18, 6) - 32;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_686(qoip_working_t *q, u8 opcode) {
 	if ( q->va==0 &&
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 128) >> 4);
-		q->out[q->p++] = ((q->avg_g + 128) & 15) << 4 | ((q->avg_gr + 32) >> 2);
-		q->out[q->p++] = (((q->avg_gr + 32) & 3) << 6) | ((q->avg_gb + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 128) << 12 | (q->avg_gr + 32) << 6 | (q->avg_gb + 32), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_686(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 15) << 4) | (b2 >> 4)) - 128;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 15) << 2) | (b3 >> 6)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 4, 8) - 128;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 63) - 32;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 18, 6) - 32;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_777(qoip_working_t *q, u8 opcode) {
@@ -545,42 +516,36 @@ static inline int qoip_enc_luma3_777(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -65 && q->avg_gr < 64 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -65 && q->avg_gb < 64 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 64) >> 2);
-		q->out[q->p++] = ((q->avg_g + 64) & 3) << 6 | ((q->avg_gr + 64) >> 1);
-		q->out[q->p++] = (((q->avg_gr + 64) & 1) << 7) | ((q->avg_gb + 64) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 64) << 14 | (q->avg_gr + 64) << 7 | (q->avg_gb + 64), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_777(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 31) << 2) | (b2 >> 6)) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 63) << 1) | (b3 >> 7)) - 64;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 3, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 7) - 64;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 127) - 64;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 17, 7) - 64;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_787(qoip_working_t *q, u8 opcode) {
 	if ( q->va==0 &&
 		q->avg_gr > -65 && q->avg_gr < 64 &&
 		q->avg_gb > -65 && q->avg_gb < 64 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 128) >> 2);
-		q->out[q->p++] = ((q->avg_g + 128) & 3) << 6 | ((q->avg_gr + 64) >> 1);
-		q->out[q->p++] = (((q->avg_gr + 64) & 1) << 7) | ((q->avg_gb + 64) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 128) << 14 | (q->avg_gr + 64) << 7 | (q->avg_gb + 64), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_787(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 63) << 2) | (b2 >> 6)) - 128;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 63) << 1) | (b3 >> 7)) - 64;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 2, 8) - 128;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 7) - 64;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 0) & 127) - 64;
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 17, 7) - 64;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma2_2321(qoip_working_t *q, u8 opcode) {
@@ -588,20 +553,19 @@ static inline int qoip_enc_luma2_2321(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -3 && q->avg_gr < 2 &&
 		q->avg_g  > -5 && q->avg_g  < 4 &&
 		q->avg_gb > -3 && q->avg_gb < 2 ) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = ((q->avg_g + 4) << 5) | ((q->avg_gr + 2) << 3) | ((q->avg_gb + 2) << 1) | ((q->va + 1) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 4) << 5 | (q->avg_gr + 2) << 3 | (q->avg_gb + 2) << 1 | (q->va + 1), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_2321(qoip_working_t *q) {
-	++q->p;
-	int b2 = q->in[q->p++];
-	int vg = ((b2 >> 5) & 7) - 4;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 3) & 3) - 2;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 8, 3) - 4;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 11, 2) - 2;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 1) & 3) - 2;
-	q->px.rgba.a += ((b2 & 1) - 1);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 13, 2) - 2;
+	q->px.rgba.a += QOIP_BITS(v, 15, 1) - 1;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_2322(qoip_working_t *q, u8 opcode) {
@@ -609,20 +573,19 @@ static inline int qoip_enc_luma2_2322(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -3 && q->avg_gr < 2 &&
 		q->avg_g  > -5 && q->avg_g  < 4 &&
 		q->avg_gb > -3 && q->avg_gb < 2 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 4) >> 2);
-		q->out[q->p++] = ((q->avg_g + 4) & 3) << 6 | ((q->avg_gr + 2) << 4) | ((q->avg_gb + 2) << 2) | ((q->va + 2) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 4) << 6 | (q->avg_gr + 2) << 4 | (q->avg_gb + 2) << 2 | (q->va + 2), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_2322(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = (((b1 & 1) << 2) | (b2 >> 6)) - 4;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 3) - 2;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 7, 3) - 4;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 2) - 2;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 2) & 3) - 2;
-	q->px.rgba.a += ((b2 & 3) - 2);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 12, 2) - 2;
+	q->px.rgba.a += QOIP_BITS(v, 14, 2) - 2;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_2422(qoip_working_t *q, u8 opcode) {
@@ -630,20 +593,19 @@ static inline int qoip_enc_luma2_2422(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -3 && q->avg_gr < 2 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -3 && q->avg_gb < 2 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 8) >> 2);
-		q->out[q->p++] = ((q->avg_g + 8) & 3) << 6 | ((q->avg_gr + 2) << 4) | ((q->avg_gb + 2) << 2) | ((q->va + 2) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 6 | (q->avg_gr + 2) << 4 | (q->avg_gb + 2) << 2 | (q->va + 2), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_2422(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = (((b1 & 3) << 2) | (b2 >> 6)) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 4) & 3) - 2;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 6, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 2) - 2;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 2) & 3) - 2;
-	q->px.rgba.a += ((b2 & 3) - 2);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 12, 2) - 2;
+	q->px.rgba.a += QOIP_BITS(v, 14, 2) - 2;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_2423(qoip_working_t *q, u8 opcode) {
@@ -651,20 +613,19 @@ static inline int qoip_enc_luma2_2423(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -3 && q->avg_gr < 2 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -3 && q->avg_gb < 2 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 8) >> 1);
-		q->out[q->p++] = ((q->avg_g + 8) & 1) << 7 | ((q->avg_gr + 2) << 5) | ((q->avg_gb + 2) << 3) | ((q->va + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 7 | (q->avg_gr + 2) << 5 | (q->avg_gb + 2) << 3 | (q->va + 4), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_2423(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = (((b1 & 7) << 1) | (b2 >> 7)) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 5) & 3) - 2;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 5, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 9, 2) - 2;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 3) & 3) - 2;
-	q->px.rgba.a += ((b2 & 7) - 4);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 11, 2) - 2;
+	q->px.rgba.a += QOIP_BITS(v, 13, 3) - 4;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_3432(qoip_working_t *q, u8 opcode) {
@@ -672,20 +633,19 @@ static inline int qoip_enc_luma2_3432(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 8) << 0);
-		q->out[q->p++] = ((q->avg_gr + 4) << 5) | ((q->avg_gb + 4) << 2) | ((q->va + 2) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 8 | (q->avg_gr + 4) << 5 | (q->avg_gb + 4) << 2 | (q->va + 2), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_3432(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 0) & 15) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 5) & 7) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 4, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 8, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 2) & 7) - 4;
-	q->px.rgba.a += ((b2 & 3) - 2);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 11, 3) - 4;
+	q->px.rgba.a += QOIP_BITS(v, 14, 2) - 2;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_3433(qoip_working_t *q, u8 opcode) {
@@ -693,20 +653,19 @@ static inline int qoip_enc_luma2_3433(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -9 && q->avg_g  < 8 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 8) << 1) | ((q->avg_gr + 4) >> 2);
-		q->out[q->p++] = (((q->avg_gr + 4) & 3) << 6) | ((q->avg_gb + 4) << 3) | ((q->va + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 8) << 9 | (q->avg_gr + 4) << 6 | (q->avg_gb + 4) << 3 | (q->va + 4), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_3433(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 1) & 15) - 8;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b1 & 1) << 2) | (b2 >> 6)) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 3, 4) - 8;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 7, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 3) & 7) - 4;
-	q->px.rgba.a += ((b2 & 7) - 4);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 10, 3) - 4;
+	q->px.rgba.a += QOIP_BITS(v, 13, 3) - 4;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_3533(qoip_working_t *q, u8 opcode) {
@@ -714,20 +673,19 @@ static inline int qoip_enc_luma2_3533(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 16) << 1) | ((q->avg_gr + 4) >> 2);
-		q->out[q->p++] = (((q->avg_gr + 4) & 3) << 6) | ((q->avg_gb + 4) << 3) | ((q->va + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 16) << 9 | (q->avg_gr + 4) << 6 | (q->avg_gb + 4) << 3 | (q->va + 4), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_3533(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 1) & 31) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b1 & 1) << 2) | (b2 >> 6)) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 2, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 7, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 3) & 7) - 4;
-	q->px.rgba.a += ((b2 & 7) - 4);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 10, 3) - 4;
+	q->px.rgba.a += QOIP_BITS(v, 13, 3) - 4;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma2_3534(qoip_working_t *q, u8 opcode) {
@@ -735,20 +693,19 @@ static inline int qoip_enc_luma2_3534(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -5 && q->avg_gr < 4 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -5 && q->avg_gb < 4 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 16) << 2) | ((q->avg_gr + 4) >> 1);
-		q->out[q->p++] = (((q->avg_gr + 4) & 1) << 7) | ((q->avg_gb + 4) << 4) | ((q->va + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 8 | (q->avg_g + 16) << 10 | (q->avg_gr + 4) << 7 | (q->avg_gb + 4) << 4 | (q->va + 8), 2);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma2_3534(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int vg = ((b1 >> 2) & 31) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b1 & 3) << 1) | (b2 >> 7)) - 4;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 1, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 6, 3) - 4;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b2 >> 4) & 7) - 4;
-	q->px.rgba.a += ((b2 & 15) - 8);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 9, 3) - 4;
+	q->px.rgba.a += QOIP_BITS(v, 12, 4) - 8;
+	q->p += 2;
 }
 
 static inline int qoip_enc_luma3_4543(qoip_working_t *q, u8 opcode) {
@@ -756,22 +713,19 @@ static inline int qoip_enc_luma3_4543(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = ((q->avg_g + 16) << 3) | ((q->avg_gr + 8) >> 1);
-		q->out[q->p++] = (((q->avg_gr + 8) & 1) << 7) | ((q->avg_gb + 8) << 3) | ((q->va + 4) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 16) << 11 | (q->avg_gr + 8) << 7 | (q->avg_gb + 8) << 3 | (q->va + 4), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_4543(qoip_working_t *q) {
-	++q->p;
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = ((b2 >> 3) & 31) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 7) << 1) | (b3 >> 7)) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 8, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 13, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 3) & 15) - 8;
-	q->px.rgba.a += ((b3 & 7) - 4);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 17, 4) - 8;
+	q->px.rgba.a += QOIP_BITS(v, 21, 3) - 4;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_4544(qoip_working_t *q, u8 opcode) {
@@ -779,22 +733,19 @@ static inline int qoip_enc_luma3_4544(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -17 && q->avg_g  < 16 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 16) >> 4);
-		q->out[q->p++] = ((q->avg_g + 16) & 15) << 4 | ((q->avg_gr + 8) << 0);
-		q->out[q->p++] = ((q->avg_gb + 8) << 4) | ((q->va + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 16) << 12 | (q->avg_gr + 8) << 8 | (q->avg_gb + 8) << 4 | (q->va + 8), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_4544(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 1) << 4) | (b2 >> 4)) - 16;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 0) & 15) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 7, 5) - 16;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 4) & 15) - 8;
-	q->px.rgba.a += ((b3 & 15) - 8);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 16, 4) - 8;
+	q->px.rgba.a += QOIP_BITS(v, 20, 4) - 8;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_4644(qoip_working_t *q, u8 opcode) {
@@ -802,22 +753,19 @@ static inline int qoip_enc_luma3_4644(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 32) >> 4);
-		q->out[q->p++] = ((q->avg_g + 32) & 15) << 4 | ((q->avg_gr + 8) << 0);
-		q->out[q->p++] = ((q->avg_gb + 8) << 4) | ((q->va + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 32) << 12 | (q->avg_gr + 8) << 8 | (q->avg_gb + 8) << 4 | (q->va + 8), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_4644(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 3) << 4) | (b2 >> 4)) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 0) & 15) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 6, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + ((b3 >> 4) & 15) - 8;
-	q->px.rgba.a += ((b3 & 15) - 8);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 16, 4) - 8;
+	q->px.rgba.a += QOIP_BITS(v, 20, 4) - 8;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_4645(qoip_working_t *q, u8 opcode) {
@@ -825,22 +773,19 @@ static inline int qoip_enc_luma3_4645(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -9 && q->avg_gr < 8 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -9 && q->avg_gb < 8 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 32) >> 3);
-		q->out[q->p++] = ((q->avg_g + 32) & 7) << 5 | ((q->avg_gr + 8) << 1) | ((q->avg_gb + 8) >> 3);
-		q->out[q->p++] = (((q->avg_gb + 8) & 7) << 5) | ((q->va + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 32) << 13 | (q->avg_gr + 8) << 9 | (q->avg_gb + 8) << 5 | (q->va + 16), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_4645(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 7) << 3) | (b2 >> 5)) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 1) & 15) - 8;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 5, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 11, 4) - 8;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b2 & 1) << 3) | (b3 >> 5)) - 8;
-	q->px.rgba.a += ((b3 & 31) - 16);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 15, 4) - 8;
+	q->px.rgba.a += QOIP_BITS(v, 19, 5) - 16;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_5654(qoip_working_t *q, u8 opcode) {
@@ -848,22 +793,19 @@ static inline int qoip_enc_luma3_5654(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 32) >> 2);
-		q->out[q->p++] = ((q->avg_g + 32) & 3) << 6 | ((q->avg_gr + 16) << 1) | ((q->avg_gb + 16) >> 4);
-		q->out[q->p++] = (((q->avg_gb + 16) & 15) << 4) | ((q->va + 8) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 32) << 14 | (q->avg_gr + 16) << 9 | (q->avg_gb + 16) << 4 | (q->va + 8), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_5654(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 15) << 2) | (b2 >> 6)) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 1) & 31) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 4, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 10, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b2 & 1) << 4) | (b3 >> 4)) - 16;
-	q->px.rgba.a += ((b3 & 15) - 8);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 15, 5) - 16;
+	q->px.rgba.a += QOIP_BITS(v, 20, 4) - 8;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_5655(qoip_working_t *q, u8 opcode) {
@@ -871,22 +813,19 @@ static inline int qoip_enc_luma3_5655(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -33 && q->avg_g  < 32 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 32) >> 1);
-		q->out[q->p++] = ((q->avg_g + 32) & 1) << 7 | ((q->avg_gr + 16) << 2) | ((q->avg_gb + 16) >> 3);
-		q->out[q->p++] = (((q->avg_gb + 16) & 7) << 5) | ((q->va + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 32) << 15 | (q->avg_gr + 16) << 10 | (q->avg_gb + 16) << 5 | (q->va + 16), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_5655(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 31) << 1) | (b2 >> 7)) - 32;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 2) & 31) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 3, 6) - 32;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 9, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b2 & 3) << 3) | (b3 >> 5)) - 16;
-	q->px.rgba.a += ((b3 & 31) - 16);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 14, 5) - 16;
+	q->px.rgba.a += QOIP_BITS(v, 19, 5) - 16;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_5755(qoip_working_t *q, u8 opcode) {
@@ -894,22 +833,19 @@ static inline int qoip_enc_luma3_5755(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 64) >> 1);
-		q->out[q->p++] = ((q->avg_g + 64) & 1) << 7 | ((q->avg_gr + 16) << 2) | ((q->avg_gb + 16) >> 3);
-		q->out[q->p++] = (((q->avg_gb + 16) & 7) << 5) | ((q->va + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 64) << 15 | (q->avg_gr + 16) << 10 | (q->avg_gb + 16) << 5 | (q->va + 16), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_5755(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = (((b1 & 63) << 1) | (b2 >> 7)) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 2) & 31) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 2, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 9, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b2 & 3) << 3) | (b3 >> 5)) - 16;
-	q->px.rgba.a += ((b3 & 31) - 16);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 14, 5) - 16;
+	q->px.rgba.a += QOIP_BITS(v, 19, 5) - 16;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma3_5756(qoip_working_t *q, u8 opcode) {
@@ -917,22 +853,19 @@ static inline int qoip_enc_luma3_5756(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -17 && q->avg_gr < 16 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -17 && q->avg_gb < 16 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 64) << 0);
-		q->out[q->p++] = ((q->avg_gr + 16) << 3) | ((q->avg_gb + 16) >> 2);
-		q->out[q->p++] = (((q->avg_gb + 16) & 3) << 6) | ((q->va + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 16 | (q->avg_g + 64) << 16 | (q->avg_gr + 16) << 11 | (q->avg_gb + 16) << 6 | (q->va + 32), 3);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma3_5756(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int vg = ((b1 >> 0) & 127) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + ((b2 >> 3) & 31) - 16;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 1, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 8, 5) - 16;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b2 & 7) << 2) | (b3 >> 6)) - 16;
-	q->px.rgba.a += ((b3 & 63) - 32);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 13, 5) - 16;
+	q->px.rgba.a += QOIP_BITS(v, 18, 6) - 32;
+	q->p += 3;
 }
 
 static inline int qoip_enc_luma4_6765(qoip_working_t *q, u8 opcode) {
@@ -940,24 +873,19 @@ static inline int qoip_enc_luma4_6765(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode;
-		q->out[q->p++] = ((q->avg_g + 64) << 1) | ((q->avg_gr + 32) >> 5);
-		q->out[q->p++] = (((q->avg_gr + 32) & 31) << 3) | ((q->avg_gb + 32) >> 3);
-		q->out[q->p++] = (((q->avg_gb + 32) & 7) << 5) | ((q->va + 16) << 0);
+		qoip_write_op(q, (u32)opcode << 24 | (q->avg_g + 64) << 17 | (q->avg_gr + 32) << 11 | (q->avg_gb + 32) << 5 | (q->va + 16), 4);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma4_6765(qoip_working_t *q) {
-	++q->p;
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int b4 = q->in[q->p++];
-	int vg = ((b2 >> 1) & 127) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 1) << 5) | (b3 >> 3)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 8, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 15, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 7) << 3) | (b4 >> 5)) - 32;
-	q->px.rgba.a += ((b4 & 31) - 16);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 21, 6) - 32;
+	q->px.rgba.a += QOIP_BITS(v, 27, 5) - 16;
+	q->p += 4;
 }
 
 static inline int qoip_enc_luma4_6766(qoip_working_t *q, u8 opcode) {
@@ -965,119 +893,94 @@ static inline int qoip_enc_luma4_6766(qoip_working_t *q, u8 opcode) {
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_g  > -65 && q->avg_g  < 64 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 64) >> 6);
-		q->out[q->p++] = ((q->avg_g + 64) & 63) << 2 | ((q->avg_gr + 32) >> 4);
-		q->out[q->p++] = (((q->avg_gr + 32) & 15) << 4) | ((q->avg_gb + 32) >> 2);
-		q->out[q->p++] = (((q->avg_gb + 32) & 3) << 6) | ((q->va + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 24 | (q->avg_g + 64) << 18 | (q->avg_gr + 32) << 12 | (q->avg_gb + 32) << 6 | (q->va + 32), 4);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma4_6766(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int b4 = q->in[q->p++];
-	int vg = (((b1 & 1) << 6) | (b2 >> 2)) - 64;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 3) << 4) | (b3 >> 4)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 7, 7) - 64;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 14, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 15) << 2) | (b4 >> 6)) - 32;
-	q->px.rgba.a += ((b4 & 63) - 32);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 20, 6) - 32;
+	q->px.rgba.a += QOIP_BITS(v, 26, 6) - 32;
+	q->p += 4;
 }
 
 static inline int qoip_enc_luma4_6866(qoip_working_t *q, u8 opcode) {
 	if ( q->va > -33 && q->va < 32 &&
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 128) >> 6);
-		q->out[q->p++] = ((q->avg_g + 128) & 63) << 2 | ((q->avg_gr + 32) >> 4);
-		q->out[q->p++] = (((q->avg_gr + 32) & 15) << 4) | ((q->avg_gb + 32) >> 2);
-		q->out[q->p++] = (((q->avg_gb + 32) & 3) << 6) | ((q->va + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 24 | (q->avg_g + 128) << 18 | (q->avg_gr + 32) << 12 | (q->avg_gb + 32) << 6 | (q->va + 32), 4);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma4_6866(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int b4 = q->in[q->p++];
-	int vg = (((b1 & 3) << 6) | (b2 >> 2)) - 128;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 3) << 4) | (b3 >> 4)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 6, 8) - 128;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 14, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 15) << 2) | (b4 >> 6)) - 32;
-	q->px.rgba.a += ((b4 & 63) - 32);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 20, 6) - 32;
+	q->px.rgba.a += QOIP_BITS(v, 26, 6) - 32;
+	q->p += 4;
 }
 
 static inline int qoip_enc_luma4_6867(qoip_working_t *q, u8 opcode) {
 	if ( q->va > -65 && q->va < 64 &&
 		q->avg_gr > -33 && q->avg_gr < 32 &&
 		q->avg_gb > -33 && q->avg_gb < 32 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 128) >> 5);
-		q->out[q->p++] = ((q->avg_g + 128) & 31) << 3 | ((q->avg_gr + 32) >> 3);
-		q->out[q->p++] = (((q->avg_gr + 32) & 7) << 5) | ((q->avg_gb + 32) >> 1);
-		q->out[q->p++] = (((q->avg_gb + 32) & 1) << 7) | ((q->va + 64) << 0);
+		qoip_write_op(q, (u32)opcode << 24 | (q->avg_g + 128) << 19 | (q->avg_gr + 32) << 13 | (q->avg_gb + 32) << 7 | (q->va + 64), 4);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma4_6867(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int b4 = q->in[q->p++];
-	int vg = (((b1 & 7) << 5) | (b2 >> 3)) - 128;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 7) << 3) | (b3 >> 5)) - 32;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 5, 8) - 128;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 13, 6) - 32;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 31) << 1) | (b4 >> 7)) - 32;
-	q->px.rgba.a += ((b4 & 127) - 64);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 19, 6) - 32;
+	q->px.rgba.a += QOIP_BITS(v, 25, 7) - 64;
+	q->p += 4;
 }
 
 static inline int qoip_enc_luma4_7876(qoip_working_t *q, u8 opcode) {
 	if ( q->va > -33 && q->va < 32 &&
 		q->avg_gr > -65 && q->avg_gr < 64 &&
 		q->avg_gb > -65 && q->avg_gb < 64 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 128) >> 4);
-		q->out[q->p++] = ((q->avg_g + 128) & 15) << 4 | ((q->avg_gr + 64) >> 3);
-		q->out[q->p++] = (((q->avg_gr + 64) & 7) << 5) | ((q->avg_gb + 64) >> 2);
-		q->out[q->p++] = (((q->avg_gb + 64) & 3) << 6) | ((q->va + 32) << 0);
+		qoip_write_op(q, (u32)opcode << 24 | (q->avg_g + 128) << 20 | (q->avg_gr + 64) << 13 | (q->avg_gb + 64) << 6 | (q->va + 32), 4);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma4_7876(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int b4 = q->in[q->p++];
-	int vg = (((b1 & 15) << 4) | (b2 >> 4)) - 128;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 15) << 3) | (b3 >> 5)) - 64;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 4, 8) - 128;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 12, 7) - 64;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 31) << 2) | (b4 >> 6)) - 64;
-	q->px.rgba.a += ((b4 & 63) - 32);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 19, 7) - 64;
+	q->px.rgba.a += QOIP_BITS(v, 26, 6) - 32;
+	q->p += 4;
 }
 
 static inline int qoip_enc_luma4_7877(qoip_working_t *q, u8 opcode) {
 	if ( q->va > -65 && q->va < 64 &&
 		q->avg_gr > -65 && q->avg_gr < 64 &&
 		q->avg_gb > -65 && q->avg_gb < 64 ) {
-		q->out[q->p++] = opcode | ((q->avg_g + 128) >> 3);
-		q->out[q->p++] = ((q->avg_g + 128) & 7) << 5 | ((q->avg_gr + 64) >> 2);
-		q->out[q->p++] = (((q->avg_gr + 64) & 3) << 6) | ((q->avg_gb + 64) >> 1);
-		q->out[q->p++] = (((q->avg_gb + 64) & 1) << 7) | ((q->va + 64) << 0);
+		qoip_write_op(q, (u32)opcode << 24 | (q->avg_g + 128) << 21 | (q->avg_gr + 64) << 14 | (q->avg_gb + 64) << 7 | (q->va + 64), 4);
 		return 1;
 	}
 	return 0;
 }
 static inline void qoip_dec_luma4_7877(qoip_working_t *q) {
-	int b1 = q->in[q->p++];
-	int b2 = q->in[q->p++];
-	int b3 = q->in[q->p++];
-	int b4 = q->in[q->p++];
-	int vg = (((b1 & 31) << 3) | (b2 >> 5)) - 128;
-	q->px.rgba.r = q->px_ref.rgba.r + vg + (((b2 & 31) << 2) | (b3 >> 6)) - 64;
+	const u64 v = qoip_peek64(q->in + q->p);
+	int vg = QOIP_BITS(v, 3, 8) - 128;
+	q->px.rgba.r = q->px_ref.rgba.r + vg + QOIP_BITS(v, 11, 7) - 64;
 	q->px.rgba.g = q->px_ref.rgba.g + vg;
-	q->px.rgba.b = q->px_ref.rgba.b + vg + (((b3 & 63) << 1) | (b4 >> 7)) - 64;
-	q->px.rgba.a += ((b4 & 127) - 64);
+	q->px.rgba.b = q->px_ref.rgba.b + vg + QOIP_BITS(v, 18, 7) - 64;
+	q->px.rgba.a += QOIP_BITS(v, 25, 7) - 64;
+	q->p += 4;
 }
 
@@ -37,6 +37,46 @@ This library provides the following functions
 	If set to NULL a default string is used. qoip_decode takes the number of channels
 	to output (3 or 4), regardless of the number of channels the file contains.
 
+	If desc->strip_height is non-zero qoip_encode splits the image into strips of
+	that many rows, each coded as an independent bitstream. Strips are encoded and
+	decoded in parallel when compiled with OpenMP (OMP_NUM_THREADS to control).
+
+	If desc->entropy_chunk is non-zero the bitstream is entropy coded in chunks of
+	that many bytes. They are entropy decoded in parallel, a single bitstream is
+	decoded as they complete rather than once they all have.
+
+	Entropy-coded files need scratch space of desc->raw_cnt bytes to decode the
+	bitstream into. Passing NULL instead decodes it a window at a time as the
+	pixels need it, saving the allocation at the cost of running on one thread.
+	LZ4 needs room for a chunk at a time, or the whole bitstream if unchunked
+
+Contexts:
+	qoip_encoder_create/encode/free, qoip_decoder_create/decode/free: The same as
+	qoip_encode/qoip_decode, but the opcode setup, entropy coder contexts and
+	scratch space are kept between calls. For encoding many small images
+
+	qoip_encode_batch: Encode an array of images with one opcode string into one
+	buffer, returning the offset and size of each. Setup is done once and the
+	images are spread over threads
+
+Dictionaries:
+	QOIP_ENTROPY_ZSTD_DICTIONARY compresses against a ZSTD dictionary, a large win
+	for small images. qoip_dict_train builds one from sample files,
+	qoip_dict_add digests it once for all later encodes and decodes. Files store
+	the id of their dictionary so decoders pick the right one
+
+Streaming encode:
+	qoip_stream_enc_begin/push_rows/end: Encode rows as they arrive, handing the
+	output to a write callback as it is produced. Memory use is bounded by the
+	image width, the header is never revisited so the bitstream size is stored
+	as unknown. Single bitstream layout, no entropy coding
+
+Streaming decode:
+	qoip_stream_dec_begin/push/end: Decode a file fed in chunks of any size,
+	handing each row to a callback as soon as it is complete. Only the current
+	row and a small input buffer are held. Single bitstream layout, no entropy
+	coding
+
 -- FORMAT:
 See README.md for layout.
 
@@ -60,6 +100,8 @@ Implementing new ops tl;dr:
 * Add op definition to id enum and qoip_ops
 * Implement encode and decode functions
 * Search for new_op in this source to find the appropriate locations
+* Fastpaths can be generated for combinations using the op by listing them in
+  qoip-fastgen.def and running qoip-fastgen.py
 * qoipcrunch maintains an independant understanding of ops/sets in qoipcrunch.c
   that will also need updating
 */
@@ -96,6 +138,23 @@ extern "C" {
 enum{QOIP_SRGB, QOIP_LINEAR};
 /* Entropy coding can optionally be used within the file format */
 enum{QOIP_ENTROPY_NONE, QOIP_ENTROPY_LZ4, QOIP_ENTROPY_ZSTD, QOIP_ENTROPY_ZSTD_DICTIONARY};
+/* Set in the file header entropy byte when the bitstream was entropy coded as
+independent chunks, located by a table of their sizes at the start of the
+entropy-coded data */
+#define QOIP_ENTROPY_CHUNKED 0x80
+/* Set in the file header entropy byte when a QOIP_ENTROPY_ZSTD_DICTIONARY file
+carries the id of its dictionary. Files from before ids don't, they decode with
+the default dictionary */
+#define QOIP_ENTROPY_DICT_ID 0x40
+/* Smallest chunk the encoder splits into, requests are raised to this */
+#define QOIP_ENTROPY_CHUNK_MIN 65536
+/* Chunk size LZ4 falls back to for bitstreams over LZ4_MAX_INPUT_SIZE */
+#define QOIP_ENTROPY_CHUNK_LZ4 (1u<<26)
+/* ZSTD level for entropy_level 0, the level dictionaries are digested at */
+#define QOIP_ZSTD_LEVEL 19
+/* Layout of the bitstream(s) within the file. Strips are independently coded
+bitstreams located by an offset table in the file header */
+enum{QOIP_LAYOUT_SINGLE, QOIP_LAYOUT_STRIPS};
 
 #define QOIP_OPCNT(id)   (1<<(7-((id)>>5)))
 #define QOIP_MASK(id)  (((1<<(7-((id)>>5)))-1)^255)
@@ -129,6 +188,16 @@ typedef struct {
 	u8 channels, colorspace;
 	u64 raw_cnt, entropy_cnt;
 	int entropy;
+	u32 strip_height;/* Rows per strip, 0 for a single bitstream */
+	u32 dict_id;/* Dictionary a QOIP_ENTROPY_ZSTD_DICTIONARY file was coded with, 0
+	if it predates dictionary ids and was coded with the default */
+	int entropy_level;/* Encode only, 0 for the entropy coder's default. ZSTD levels
+	                     as is (negative for the fast modes), LZ4 >0 for HC levels
+	                     and <0 for acceleration */
+	int entropy_threads;/* Encode only, ZSTD worker threads when above 1 */
+	u32 entropy_chunk;/* Bitstream bytes per independently entropy coded chunk, 0
+	                     for one. On encode a request, LZ4 past LZ4_MAX_INPUT_SIZE
+	                     is chunked regardless. Chunks are decoded in parallel */
 } qoip_desc;
 
 /* A raw pixel, exposed for smart crunch function */
@@ -137,13 +206,22 @@ typedef union {
 	u32 v;
 } qoip_rgba_t;
 
+/* Tables only some opstrings use, kept out of qoip_working_t so that stays small
+enough to zero on every call. qoip_init_tables clears just the ones in use */
+typedef struct {
+	u8 hash_pos[QOIP_FIFO_HASH_SIZE];/* Encoder FIFO slot by hash, index_wpos & 255 */
+	qoip_rgba_t index2[1024];
+} qoip_tables_t;
+
 /* Working state of an encode/decode run, exposed for smart crunch function */
 typedef struct {
 	size_t in_tot, bitstream_loc, p, px_pos, px_w, px_h, width, height, stride;
-	int channels, hash, run, run1_len, run2_len, index1_mask, index1_opcode, index1_maxval, index2_maxval, index_wpos, hash_pos[QOIP_FIFO_HASH_SIZE];
-	unsigned char *restrict out, upcache[8192*3];
+	int channels, hash, run, run1_len, run2_len, index1_mask, index1_opcode, index1_maxval, index2_maxval, index_wpos;
+	unsigned char *restrict out;
 	const unsigned char *restrict in;
-	qoip_rgba_t index[128], index2[1024], px, px_prev, px_ref;
+	u8 *hash_pos;/* Side tables, see qoip_tables_t */
+	qoip_rgba_t *index2;
+	qoip_rgba_t index[128], px, px_prev, px_ref;
 	i8 vr, vg, vb, va;/*Difference from previous */
 	i8 avg_r, avg_g, avg_b, avg_gr, avg_gb;/* Difference from average */
 	u8 run1_opcode, run2_opcode, rgb_opcode, rgba_opcode;/* Implicit opcodes */
@@ -163,7 +241,8 @@ enum{QOIP_SET_INDEX1, QOIP_SET_LEN1, QOIP_SET_INDEX2, QOIP_SET_LEN2, QOIP_SET_LE
 /* Encode/decode functions assume out is large enough (see maxsize functions) */
 /* Decode a QOIP image from memory. The function either returns >0 on failure
 (invalid parameters) or 0 on success. On success, the qoip_desc struct is filled
-with the description from the file header. */
+with the description from the file header. scratch is needed for entropy-coded
+files only, desc->raw_cnt bytes or NULL to entropy decode in a small window */
 int qoip_decode(const void *data, const size_t data_len, qoip_desc *desc, const int channels, void *out, void *scratch);
 
 /* Encode raw RGB or RGBA pixels into a QOIP image in memory. The function either
@@ -172,10 +251,123 @@ is its size in bytes. opcode_string defines the opcode combination to use. It is
 to the caller to ensure this string is valid */
 int qoip_encode(const void *data, const qoip_desc *desc, void *out, size_t *out_len, const char *opcode_string, const int entropy, void *scratch);
 
+/* Encoder context, opaque. Not thread safe, use one per thread */
+typedef struct qoip_encoder qoip_encoder_t;
+
+/* Create an encoder for a fixed opcode string and entropy coder. Returns >0 on
+failure, otherwise *e must be freed with qoip_encoder_free */
+int qoip_encoder_create(qoip_encoder_t **e, const char *opcode_string, const int entropy);
+
+/* qoip_encode with e's opcode string and entropy coder, scratch space for the
+entropy coder is kept in e */
+int qoip_encoder_encode(qoip_encoder_t *e, const void *data, const qoip_desc *desc, void *out, size_t *out_len);
+
+void qoip_encoder_free(qoip_encoder_t *e);
+
+/* Use dict for QOIP_ENTROPY_ZSTD_DICTIONARY instead of the default dictionary.
+dict is copied and digested once here at QOIP_ZSTD_LEVEL, other entropy_levels
+digest it per encode. Returns >0 on failure */
+int qoip_encoder_set_dict(qoip_encoder_t *e, const void *dict, const size_t dict_cnt);
+
+/* An image of a batch encode. offset and len are filled in by qoip_encode_batch */
+typedef struct {
+	const void *data;
+	qoip_desc desc;
+	size_t offset, len;
+} qoip_batch_item_t;
+
+/* Size out needs to be for qoip_encode_batch */
+size_t qoip_batch_maxsize(const qoip_batch_item_t *items, const size_t cnt);
+
+/* Encode cnt images with one opcode string and entropy coder into out, back to
+back. The opcode string is set up once for the whole batch and the images are
+shared out between threads when compiled with OpenMP. On success out_len is the
+total size and each item has where its image is in out. Returns >0 on failure */
+int qoip_encode_batch(qoip_batch_item_t *items, const size_t cnt, const char *opcode_string, const int entropy, const int threads, void *out, size_t *out_len);
+
+/* Decoder context, opaque. Not thread safe, use one per thread */
+typedef struct qoip_decoder qoip_decoder_t;
+
+/* Create a decoder. Returns >0 on failure, otherwise *d must be freed with
+qoip_decoder_free */
+int qoip_decoder_create(qoip_decoder_t **d);
+
+/* qoip_decode with scratch space and entropy contexts kept in d. The ops of the
+last file are kept expanded, so files using the same ops skip that setup */
+int qoip_decoder_decode(qoip_decoder_t *d, const void *data, const size_t data_len, qoip_desc *desc, const int channels, void *out);
+
+void qoip_decoder_free(qoip_decoder_t *d);
+
+/* The decoder side of qoip_encoder_set_dict, dict must outlive d. Files coded
+with a different dictionary fail to decode */
+void qoip_decoder_set_dict(qoip_decoder_t *d, const void *dict, const size_t dict_cnt);
+
+/* Train a ZSTD dictionary of at most *dict_cnt bytes for QOIP_ENTROPY_ZSTD_DICTIONARY
+from the bitstreams of cnt QOIP files without entropy coding. On success *dict_cnt
+is the size of the dictionary. Returns >0 on failure, ZSTD wants a few hundred
+files at least */
+int qoip_dict_train(void *dict, size_t *dict_cnt, const void *const *files, const size_t *file_lens, const size_t cnt);
+
+/* Add a dictionary for QOIP_ENTROPY_ZSTD_DICTIONARY, digesting it once for all
+decodes and encodes at QOIP_ZSTD_LEVEL (other entropy_levels digest it per
+encode). dict is copied. *id (may be NULL) is the id stored in files
+coded with it, decoders look dictionaries up by that id. The last dictionary
+added is the default for encoders without qoip_encoder_set_dict. With none added
+the file "dictionary" in the working directory is added on first use. Not thread
+safe, add dictionaries before encoding/decoding. Returns >0 on failure */
+int qoip_dict_add(const void *dict, const size_t dict_cnt, u32 *id);
+
+/* Free all added dictionaries */
+void qoip_dict_clear(void);
+
+/* Called with each piece of output of a streaming encode, in order. Return
+non-zero to abort the encode */
+typedef int (*qoip_write_fn)(void *user, const void *data, size_t len);
+
+/* Streaming encoder state, opaque */
+typedef struct qoip_stream_enc qoip_stream_enc_t;
+
+/* Start a streaming encode of an image described by desc (strip_height must be
+0). Allocates *s, which is freed by qoip_stream_enc_end. The headers are written
+before returning. Returns >0 on failure, in which case nothing is allocated */
+int qoip_stream_enc_begin(qoip_stream_enc_t **s, const qoip_desc *desc, const char *opcode_string, qoip_write_fn write, void *user);
+
+/* Encode the next rows of the image, rows holds row_cnt rows of width*channels
+bytes. Returns >0 on failure */
+int qoip_stream_enc_push_rows(qoip_stream_enc_t *s, const void *rows, size_t row_cnt);
+
+/* Finish the bitstream, flush the remaining output and free s. Fails if fewer
+rows than the image height were pushed, s is freed regardless */
+int qoip_stream_enc_end(qoip_stream_enc_t *s);
+
+/* Called with each decoded row of a streaming decode, in order. y is the row
+index, row is only valid for the duration of the call. Return non-zero to
+abort the decode */
+typedef int (*qoip_row_fn)(void *user, const void *row, u32 y);
+
+/* Streaming decoder state, opaque */
+typedef struct qoip_stream_dec qoip_stream_dec_t;
+
+/* Start a streaming decode producing rows of channels (3, 4 or 0 for the
+file's channels). Allocates *s, which is freed by qoip_stream_dec_end */
+int qoip_stream_dec_begin(qoip_stream_dec_t **s, const int channels, qoip_row_fn row, void *user);
+
+/* Feed the next len bytes of the file. Every row completed by them is passed to
+the row callback before returning. Returns >0 on failure */
+int qoip_stream_dec_push(qoip_stream_dec_t *s, const void *data, size_t len);
+
+/* Fill desc from the file header. Returns non-zero if the headers have not been
+pushed yet */
+int qoip_stream_dec_desc(const qoip_stream_dec_t *s, qoip_desc *desc);
+
+/* Free s. Fails if the image was not complete */
+int qoip_stream_dec_end(qoip_stream_dec_t *s);
+
 /*Init q, used internally by qoip_encode and qoipcrunch_encode_* */
 void qoip_init_working_memory(qoip_working_t *restrict q, const void *data, const qoip_desc *desc);
 
-/* Return the maximum size of a no-entropy-coding QOIP image with dimensions in desc */
+/* Return the maximum size of a no-entropy-coding QOIP image with dimensions
+(and strip height) in desc */
 size_t qoip_maxsize(const qoip_desc *desc);
 
 /* Return the maximum size of a decoded image with dimensions in desc */
@@ -184,16 +376,32 @@ size_t qoip_maxsize_raw(const qoip_desc *desc, int channels);
 /* Maximum size of an entropy-coded chunk of data, for implementation usage */
 size_t qoip_maxentropysize(size_t src, int entropy);
 
-/* Bolted-on entropy coding, exposed so qoipcrunch_encode can use it */
-static int qoip_entropy(void *out, size_t *out_len, void *tmp, const int entropy);
-
-/* Populate desc by reading a QOIP header. If loc is NULL, read from
-bytes + 0, otherwise read from bytes + *loc. Advance loc if present.
+/* Entropy coder state kept between calls by an encoder context. NULL members
+are created for the call, a NULL cdict means the default dictionary. level and
+threads are as in qoip_desc. cdict is digested at QOIP_ZSTD_LEVEL, other levels
+digest dict for the call. chunk is qoip_desc.entropy_chunk */
+typedef struct {
+	void *cctx, *lz4_state, *lz4hc_state;/* ZSTD_CCtx, LZ4 states */
+	const void *cdict;/* ZSTD_CDict */
+	const void *dict;/* What cdict was digested from */
+	size_t dict_cnt;
+	u32 dict_id;
+	int level, threads;
+	u32 chunk;
+} qoip_entropy_ctx_t;
+
+/* Bolted-on entropy coding of the file in out, exposed so qoipcrunch_encode can
+use it. tmp needs room for the bitstream. ctx may be NULL */
+static inline int qoip_entropy(void *out, size_t *out_len, void *tmp, const int entropy, const qoip_entropy_ctx_t *ctx);
+
+/* Populate desc by reading a QOIP header from the len bytes at bytes. If loc is
+NULL, read from bytes + 0, otherwise read from bytes + *loc. Advance loc if present.
 Convenience method for external code to read entire header without knowing internals */
-int qoip_read_header(const unsigned char *bytes, size_t *loc, qoip_desc *desc);
+int qoip_read_header(const unsigned char *bytes, size_t len, size_t *loc, qoip_desc *desc);
 
-/* File header read separately */
-int qoip_read_file_header(const unsigned char *bytes, size_t *p, qoip_desc *desc);
+/* File header read separately, fails if it or the bitstream header following it
+would run past len */
+int qoip_read_file_header(const unsigned char *bytes, size_t len, size_t *p, qoip_desc *desc);
 
 /* Bitstream header read separately, just enough to determine its size.
 This exists to avoid exposing internals with qoip_read_bitstream_header */
@@ -202,8 +410,8 @@ int qoip_skip_bitstream_header(const unsigned char *bytes, size_t *p, qoip_desc
 /* Print s to io and return ret, typically used to print error and return error code */
 int qoip_ret(const int ret, FILE *io, const char *s);
 
-/* Print details from a QOIP file */
-int qoip_stat(const void *encoded, FILE *io);
+/* Print details from a QOIP file of len bytes */
+int qoip_stat(const void *encoded, size_t len, FILE *io);
 
 inline void qoip_gen_var_rgb(qoip_working_t *restrict q);
 
@@ -216,11 +424,27 @@ const opdef_t* qoip_op_lookup(u8 id);
 #endif
 #endif /* QOIP_H */
 
-#ifdef QOIP_C
+/* Once only, headers built on qoip.h include it again */
+#if defined(QOIP_C) && !defined(QOIP_C_DONE)
+#define QOIP_C_DONE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "lz4.h"
+#include "lz4hc.h"
 #include "zstd.h"
+#include "zdict.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#endif
 
 /* Runtime opcodes built from master definitions */
 typedef struct {
@@ -253,6 +477,59 @@ int opcode_comp_id(const void *aa, const void *bb) {
 		return a->id<b->id ? -1: 1;
 }
 
+/* The 8 bytes at p with the first in the top byte, so the fields of an op are
+read off in the order they are written with QOIP_BITS. Bitstreams are followed
+by at least 8 bytes of padding, so this stays in the buffer for any op in one */
+static inline u64 qoip_peek64(const unsigned char *p) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+	u64 v;
+	memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+#else
+	return (u64)p[0] << 56 | (u64)p[1] << 48 | (u64)p[2] << 40 | (u64)p[3] << 32 |
+	       (u64)p[4] << 24 | (u64)p[5] << 16 | (u64)p[6] <<  8 | (u64)p[7];
+#endif
+}
+
+/* n bits starting o bits into the op peeked as v */
+#define QOIP_BITS(v, o, n) ((int)(((v) >> (64 - (o) - (n))) & ((1u << (n)) - 1)))
+
+/* Write the n byte op held in the low bytes of v, first byte most significant,
+at q->out + q->p and move past it. One 4 or 8 byte store, the bytes past the op
+are overwritten by what follows it. qoip_maxsize leaves at least 8 bytes after
+the last op for the footer, so this stays in the buffer for any op in one */
+static inline void qoip_write_op(qoip_working_t *q, const u64 v, const int n) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__)
+	if(n <= 4) {
+		u32 w = (u32)v << (32 - 8 * n);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		w = __builtin_bswap32(w);
+#endif
+		memcpy(q->out + q->p, &w, 4);
+	}
+	else {
+		u64 w = v << (64 - 8 * n);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		memcpy(q->out + q->p, &w, 8);
+	}
+#else
+	int i;
+	for(i=0;i<n;++i)
+		q->out[q->p + i] = v >> (8 * (n - 1 - i));
+#endif
+	q->p += n;
+}
+
+/* RGB/RGBA ops for qoip_write_op, the opcode byte followed by the channels */
+#define QOIP_OP_RGB(opcode, px) \
+	((u32)(opcode) << 24 | (u32)(px).rgba.r << 16 | (u32)(px).rgba.g << 8 | (px).rgba.b)
+#define QOIP_OP_RGBA(opcode, px) ((u64)QOIP_OP_RGB(opcode, px) << 8 | (px).rgba.a)
+
 /* Op encode/decode functions split into qoip-func.c, new_op functions go there */
 #include "qoip-func.c"
 
@@ -331,16 +608,10 @@ void qoip_print_op(const opdef_t *op, FILE *io) {
 	fprintf(io, "%s, id=%02x\n", op->desc, op->id);
 }
 
-static inline void qoip_memcpy(void *restrict d, void *restrict s, const size_t len) {
-	size_t i;
-	for(i=0;i<len;++i)
-		((char*)d)[i]=((char*)s)[i];
-}
 static inline void qoip_opcode_swap(qoip_opcode_t *restrict a, qoip_opcode_t *restrict b) {
-	qoip_opcode_t t;
-	qoip_memcpy(&t, a, sizeof(qoip_opcode_t));
-	qoip_memcpy(a, b, sizeof(qoip_opcode_t));
-	qoip_memcpy(b, &t, sizeof(qoip_opcode_t));
+	qoip_opcode_t t = *a;
+	*a = *b;
+	*b = t;
 }
 /* Bad sort algorithm but set is tiny so it's fine */
 static inline void qoip_sort_set(qoip_opcode_t *ops, const int op_cnt) {
@@ -362,7 +633,7 @@ static u32 qoip_read_32(const unsigned char *bytes, size_t *p) {
 	u32 r = bytes[(*p)++];
 	r |= (bytes[(*p)++] <<  8);
 	r |= (bytes[(*p)++] << 16);
-	r |= (bytes[(*p)++] << 24);
+	r |= ((u32)bytes[(*p)++] << 24);
 	return r;
 }
 
@@ -370,7 +641,7 @@ static u64 qoip_read_64(const unsigned char *bytes, size_t *p) {
 	u64 r = bytes[(*p)++];
 	r |= (bytes[(*p)++] <<  8);
 	r |= (bytes[(*p)++] << 16);
-	r |= (bytes[(*p)++] << 24);
+	r |= ((u64)bytes[(*p)++] << 24);
 	r |= ((u64)bytes[(*p)++] << 32);
 	r |= ((u64)bytes[(*p)++] << 40);
 	r |= ((u64)bytes[(*p)++] << 48);
@@ -378,19 +649,72 @@ static u64 qoip_read_64(const unsigned char *bytes, size_t *p) {
 	return r;
 }
 
-int qoip_read_file_header(const unsigned char *bytes, size_t *p, qoip_desc *desc) {
-	size_t loc = p ? *p : 0;
-	unsigned int header_magic = qoip_read_32(bytes, &loc);
+static inline u32 qoip_strip_cnt(const qoip_desc *desc) {
+	return (desc->height + desc->strip_height - 1) / desc->strip_height;
+}
+
+/* Bytes of file header after raw_cnt describing entropy coding: entropy_cnt,
+dict_id if present and the chunk size/count if chunked */
+static inline size_t qoip_entropy_fields_size(const int dict, const size_t chunk) {
+	return 8 + (dict ? 8 : 0) + (chunk ? 8 : 0);
+}
+
+/* dict_id is 0 when a file has none */
+static inline size_t qoip_entropy_header_size(const qoip_desc *desc) {
+	return desc->entropy ? qoip_entropy_fields_size(desc->dict_id, desc->entropy_chunk) : 0;
+}
+
+static inline u32 qoip_entropy_chunk_cnt(const qoip_desc *desc) {
+	return (desc->raw_cnt + desc->entropy_chunk - 1) / desc->entropy_chunk;
+}
+
+int qoip_read_file_header(const unsigned char *bytes, const size_t len, size_t *p, qoip_desc *desc) {
+	size_t loc = p ? *p : 0, strip_cnt;
+	unsigned int header_magic;
+	u8 layout, entropy;
+	if(loc + 16 > len)
+		return 1;
+	header_magic = qoip_read_32(bytes, &loc);
 	desc->channels = bytes[loc++];
 	desc->colorspace = bytes[loc++];
-	desc->entropy = bytes[loc++];
-	++loc;/*padding*/
+	entropy = bytes[loc++];
+	desc->entropy = entropy & ~(QOIP_ENTROPY_CHUNKED | QOIP_ENTROPY_DICT_ID);
+	layout = bytes[loc++];
 	desc->raw_cnt = qoip_read_64(bytes, &loc);
+	if(loc + (desc->entropy ? qoip_entropy_fields_size(entropy & QOIP_ENTROPY_DICT_ID, entropy & QOIP_ENTROPY_CHUNKED) : 0) + (layout==QOIP_LAYOUT_STRIPS ? 8 : 0) > len)
+		return 1;
 	desc->entropy_cnt = desc->entropy ? qoip_read_64(bytes, &loc) : 0;
+	desc->dict_id = 0;
+	desc->entropy_level = 0;
+	desc->entropy_threads = 0;
+	if(entropy & QOIP_ENTROPY_DICT_ID) {
+		desc->dict_id = qoip_read_32(bytes, &loc);
+		loc += 4;/* Reserved */
+	}
+	desc->entropy_chunk = 0;
+	if(entropy & QOIP_ENTROPY_CHUNKED) {
+		desc->entropy_chunk = qoip_read_32(bytes, &loc);
+		loc += 4;/* Chunk count, implied by raw_cnt */
+	}
+	desc->strip_height = 0;
+	if(layout==QOIP_LAYOUT_STRIPS) {/* Skip the offset table, read by qoip_decode */
+		desc->strip_height = qoip_read_32(bytes, &loc);
+		strip_cnt = qoip_read_32(bytes, &loc);
+		if(strip_cnt > (len - loc) / 8)
+			return 1;
+		loc += 8 * strip_cnt;
+	}
+	/* The bitstream header is 8 byte aligned, with its op count at byte 9 */
+	if(loc + 10 > len || loc + ((10 + (size_t)bytes[loc + 9] + 7) & ~(size_t)7) > len)
+		return 1;
 	if (p)
 		*p = loc;
 	return desc->channels < 3 || desc->channels > 4 ||
-		desc->colorspace > 1 || header_magic != QOIP_MAGIC;
+		desc->colorspace > 1 || header_magic != QOIP_MAGIC ||
+		((entropy & QOIP_ENTROPY_CHUNKED) && (desc->entropy==QOIP_ENTROPY_NONE || desc->entropy_chunk < QOIP_ENTROPY_CHUNK_MIN)) ||
+		((entropy & QOIP_ENTROPY_DICT_ID) && (desc->entropy!=QOIP_ENTROPY_ZSTD_DICTIONARY || desc->dict_id==0)) ||
+		(desc->entropy && desc->raw_cnt < 8) ||/* Shorter than the padding */
+		layout > QOIP_LAYOUT_STRIPS || (layout==QOIP_LAYOUT_STRIPS && desc->strip_height==0);
 }
 
 int qoip_skip_bitstream_header(const unsigned char *bytes, size_t *p, qoip_desc *desc) {
@@ -418,6 +742,8 @@ int qoip_read_bitstream_header(const unsigned char *bytes, size_t *p, qoip_desc
 	desc->height = qoip_read_32(bytes, &loc);
 	version = bytes[loc++];
 	cnt = bytes[loc++];
+	if(cnt > OP_END)
+		return 1;
 	if(op_cnt)
 		*op_cnt = cnt;
 	if(ops) {
@@ -438,11 +764,18 @@ int qoip_read_bitstream_header(const unsigned char *bytes, size_t *p, qoip_desc
 	return desc->width == 0 || desc->height == 0 || version || cnt == 0;
 }
 
-int qoip_read_header(const unsigned char *bytes, size_t *p, qoip_desc *desc) {
+/* 1 if the strip count stored in the file header at bytes does not match the
+dimensions read from the bitstream header */
+static int qoip_strip_cnt_invalid(const unsigned char *bytes, const qoip_desc *desc) {
+	size_t loc = 20 + qoip_entropy_header_size(desc);/* Past strip_height */
+	return desc->strip_height && qoip_read_32(bytes, &loc) != qoip_strip_cnt(desc);
+}
+
+int qoip_read_header(const unsigned char *bytes, const size_t len, size_t *p, qoip_desc *desc) {
 	size_t loc = p ? *p : 0;
-	if(qoip_read_file_header(bytes, &loc, desc))
+	if(qoip_read_file_header(bytes, len, &loc, desc))
 		return 1;
-	if(qoip_read_bitstream_header(bytes, &loc, desc, NULL, NULL))
+	if(qoip_read_bitstream_header(bytes, &loc, desc, NULL, NULL) || qoip_strip_cnt_invalid(bytes + (p ? *p : 0), desc))
 		return 1;
 	if (p)
 		*p = loc;
@@ -468,17 +801,23 @@ static void qoip_write_64(unsigned char *bytes, u64 v) {
 }
 
 void qoip_write_file_header(unsigned char *bytes, size_t *p, const qoip_desc *desc) {
-	int i;
+	size_t i;
 	qoip_write_32(bytes, p, QOIP_MAGIC);
 	bytes[(*p)++] = desc->channels;
 	bytes[(*p)++] = desc->colorspace;
 	bytes[(*p)++] = 0;/*entropy coding, 0 placeholder non-streaming implementation*/
-	bytes[(*p)++] = 0;/*padding*/
+	bytes[(*p)++] = desc->strip_height ? QOIP_LAYOUT_STRIPS : QOIP_LAYOUT_SINGLE;
 	for(i=0;i<8;++i)/*size placeholder*/
 		bytes[(*p)++] = 0;
+	if(desc->strip_height) {
+		qoip_write_32(bytes, p, desc->strip_height);
+		qoip_write_32(bytes, p, qoip_strip_cnt(desc));
+		for(i=0;i<8*(size_t)qoip_strip_cnt(desc);++i)/*offset table placeholder*/
+			bytes[(*p)++] = 0;
+	}
 }
 
-void qoip_write_bitstream_header(unsigned char *bytes, size_t *p, const qoip_desc *desc, qoip_opcode_t *ops, u8 op_cnt) {
+void qoip_write_bitstream_header(unsigned char *bytes, size_t *p, const qoip_desc *desc, const qoip_opcode_t *ops, u8 op_cnt) {
 	int i;
 	qoip_write_32(bytes, p, desc->width);
 	qoip_write_32(bytes, p, desc->height);
@@ -495,6 +834,8 @@ size_t qoip_maxsize(const qoip_desc *desc) {
 	if( desc == NULL || desc->width == 0 || desc->height == 0 )
 		return 0;
 	max_size = desc->width * desc->height * (desc->channels + 1) + QOIP_FILE_HEADER_SIZE + QOIP_BITSTREAM_HEADER_MAXSIZE + 16/*footer*/;
+	if(desc->strip_height)/* Offset table, plus a footer per strip */
+		max_size += 8 + (size_t)qoip_strip_cnt(desc) * (8 + 16);
 	return max_size;
 }
 
@@ -547,6 +888,7 @@ static int parse_opstring(const char *opstr, qoip_opcode_t *ops, int *op_cnt) {
 		if(opcodes_present[i]) {
 			if(opcodes_present[i] > 1)
 				printf("WARNING: opcode %02x present multiple times in opstring, proceeding with it deduplicated\n", i);
+			ops[*op_cnt].freq = 0;
 			ops[(*op_cnt)++].id = i;
 			opdef = qoip_op_lookup(i);
 			if(!opdef)
@@ -568,6 +910,7 @@ static int parse_opstring(const char *opstr, qoip_opcode_t *ops, int *op_cnt) {
 static int qoip_expand_opcodes(const int *op_cnt, qoip_opcode_t *ops, qoip_working_t *q) {
 	int i, op = 0;
 	const opdef_t *opdef;
+	q->index2_maxval = 1023;
 	for(i=0;i<*op_cnt;++i) {
 		opdef = qoip_op_lookup(ops[i].id);
 		if(!opdef)
@@ -599,24 +942,146 @@ static int qoip_expand_opcodes(const int *op_cnt, qoip_opcode_t *ops, qoip_worki
 	return 0;
 }
 
+/* Point q at t, clearing only the tables the expanded ops read. The decoder
+never looks FIFO slots up so only an encoder needs hash_pos */
+static void qoip_init_tables(qoip_working_t *restrict q, qoip_tables_t *restrict t, const qoip_opcode_t *op, const int op_cnt, const int enc) {
+	int i;
+	q->hash_pos = t->hash_pos;
+	q->index2 = t->index2;
+	for(i=0;i<op_cnt;++i) {
+		if(enc && op[i].set==QOIP_SET_INDEX1 && QOIP_IS_FIFO_INDEX(op[i].id))
+			memset(t->hash_pos, 0, sizeof(t->hash_pos));
+		if(op[i].set==QOIP_SET_INDEX2)
+			memset(t->index2, 0, (q->index2_maxval + 1) * sizeof(qoip_rgba_t));
+	}
+}
+
 static inline void qoip_encode_run(qoip_working_t *restrict q) {
 	if(q->run) {
 		const size_t quot = q->run/q->run2_len, rem = q->run%q->run2_len;
 		size_t i;
-		for(i=0;i<quot;++i) {
-			q->out[q->p++] = q->run2_opcode;
-			q->out[q->p++] = 255;
-		}
-		if(rem>q->run1_len) {
-			q->out[q->p++] = q->run2_opcode;
-			q->out[q->p++] = (rem - 1) - q->run1_len;
-		}
+		for(i=0;i<quot;++i)
+			qoip_write_op(q, (u32)q->run2_opcode << 8 | 255, 2);
+		if(rem>q->run1_len)
+			qoip_write_op(q, (u32)q->run2_opcode << 8 | ((rem - 1) - q->run1_len), 2);
 		else if(rem)
 			q->out[q->p++] = q->run1_opcode + (rem - 1);
 		q->run = 0;
 	}
 }
 
+/* Count the pixels at in equal to px, stopping at the first mismatch or max */
+static inline size_t qoip_scan_run(const unsigned char *restrict in, const qoip_rgba_t px, const int channels, const size_t max) {
+	size_t n=0;
+	if(channels==4) {
+#if defined(__AVX2__)
+		const __m256i v = _mm256_set1_epi32(px.v);
+		for(;n+8<=max;n+=8) {
+			const u32 m = _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(in + n*4)), v));
+			if(m!=0xffffffff)
+				return n + (__builtin_ctz(~m)>>2);
+		}
+#elif defined(__SSE2__)
+		const __m128i v = _mm_set1_epi32(px.v);
+		for(;n+8<=max;n+=8) {
+			const u32 m = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(in + n*4)), v)) |
+				(u32)_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(in + n*4 + 16)), v)) << 16;
+			if(m!=0xffffffff)
+				return n + (__builtin_ctz(~m)>>2);
+		}
+#endif
+		for(;n<max && ((const qoip_rgba_t *)(in + n*4))->v==px.v;++n);
+	}
+	else {
+#if defined(__SSE2__)
+		/* 16 RGB pixels fill 3 vectors exactly, so the pattern lines up every 48 bytes */
+		u8 pat[48];
+		__m128i v0, v1, v2;
+		u64 m;
+		int i;
+		for(i=0;i<16;++i) {
+			pat[i*3+0] = px.rgba.r;
+			pat[i*3+1] = px.rgba.g;
+			pat[i*3+2] = px.rgba.b;
+		}
+		v0 = _mm_loadu_si128((const __m128i *)(pat + 0));
+		v1 = _mm_loadu_si128((const __m128i *)(pat + 16));
+		v2 = _mm_loadu_si128((const __m128i *)(pat + 32));
+		for(;n+16<=max;n+=16) {
+			m = (u64)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(in + n*3 + 0)), v0)) |
+				(u64)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(in + n*3 + 16)), v1)) << 16 |
+				(u64)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(in + n*3 + 32)), v2)) << 32;
+			if(m!=0xffffffffffffull)
+				return n + __builtin_ctzll(~m)/3;
+		}
+#endif
+		for(;n<max && in[n*3+0]==px.rgba.r && in[n*3+1]==px.rgba.g && in[n*3+2]==px.rgba.b;++n);
+	}
+	return n;
+}
+
+/* Repeat the first unit bytes of p up to len bytes, doubling the copied span
+each step like a pattern memset */
+static inline void qoip_fill_pattern(unsigned char *restrict p, const size_t unit, const size_t len) {
+	size_t done;
+	for(done=unit;done<len;done*=2)
+		memcpy(p + done, p, done*2>len ? len-done : done);
+}
+
+/* Current pixel continues a run. Extend the run over the identical pixels that
+follow it in this row and leave px_w/px_pos on the last of them, so the caller's
+per-pixel bookkeeping (index2) happens once for the whole span */
+static inline void qoip_extend_run(qoip_working_t *restrict q) {
+	const size_t n = qoip_scan_run(q->in + q->px_pos + q->channels, q->px, q->channels, q->width - q->px_w - 1);
+	q->run += n + 1;
+	if(n) {
+		q->px_w += n;
+		q->px_pos += n * q->channels;
+	}
+}
+
+/* Write n copies of px to out */
+static inline void qoip_fill_px(unsigned char *restrict out, const qoip_rgba_t px, const int channels, const size_t n) {
+	size_t i=0;
+	if(!n)
+		return;
+	if(channels==4) {
+#if defined(__AVX2__)
+		const __m256i v = _mm256_set1_epi32(px.v);
+		for(;i+8<=n;i+=8)
+			_mm256_storeu_si256((__m256i *)(out + i*4), v);
+#elif defined(__SSE2__)
+		const __m128i v = _mm_set1_epi32(px.v);
+		for(;i+8<=n;i+=8) {
+			_mm_storeu_si128((__m128i *)(out + i*4), v);
+			_mm_storeu_si128((__m128i *)(out + i*4 + 16), v);
+		}
+#endif
+		for(;i<n;++i)
+			*(qoip_rgba_t *)(out + i*4) = px;
+	}
+	else {
+		out[0] = px.rgba.r;
+		out[1] = px.rgba.g;
+		out[2] = px.rgba.b;
+		qoip_fill_pattern(out, 3, n*3);
+	}
+}
+
+/* Decoder side of qoip_extend_run, called while a run is pending. Writes the
+run pixels left in this row at once and leaves px_w/px_pos on the last of them,
+which the caller stores as usual. The run repeats px, so the indexes written
+when the run op was decoded still hold and are not touched */
+static inline void qoip_expand_run(qoip_working_t *restrict q) {
+	size_t n = q->width - q->px_w;
+	if(n>(size_t)q->run)
+		n = q->run;
+	q->run -= n;
+	qoip_fill_px(q->out + q->px_pos, q->px, q->channels, n - 1);
+	q->px_w += n - 1;
+	q->px_pos += (n - 1) * q->channels;
+}
+
 int qoip_ret(const int ret, FILE *io, const char *s) {
 	fprintf(io, "%s\n", s);
 	return ret;
@@ -629,99 +1094,368 @@ static void qoip_finish(qoip_working_t *restrict q) {
 	q->out[q->p++] = 0;
 	for(;q->p%8;)
 		q->out[q->p++] = 0;
-
-	/* Write bitstream size to file header, a streaming version might skip this step */
-	qoip_write_64(q->out+8, q->p-q->bitstream_loc);
 }
 
 size_t qoip_maxentropysize(const size_t src, const int entropy) {
 	switch(entropy) {
 		case 0:
 			return src;
-		case 1:
-			return LZ4_compressBound(src);
-		case 2:
-			return ZSTD_compressBound(src);
+		case 1:/* LZ4_compressBound of every chunk, and the chunk table */
+			return src + src / 255 + (src / QOIP_ENTROPY_CHUNK_MIN + 1) * 20 + 8;
+		case 2:/* ZSTD_compressBound of every chunk, and the chunk table */
+			return ZSTD_compressBound(src) + (src / QOIP_ENTROPY_CHUNK_MIN + 1) * 40 + 8;
 		case 3:
-			return ZSTD_compressBound(src);
+			return ZSTD_compressBound(src) + (src / QOIP_ENTROPY_CHUNK_MIN + 1) * 40 + 8;
 		default:
 			return 0;
 	}
 }
 
-/*temporarily implement a dictionary as global nonsense for testing*/
-static char qoip_dic[112640];
-static size_t qoip_dic_cnt=112640;
-static int qoip_dic_loaded=0;
+/* Added dictionaries, digested for both directions. The dictionary is kept for
+encodes at other levels than the CDict's */
+#define QOIP_DICT_MAX 16
+typedef struct {
+	u32 id;
+	void *dict;
+	size_t dict_cnt;
+	ZSTD_CDict *cdict;
+	ZSTD_DDict *ddict;
+} qoip_dict_t;
+static qoip_dict_t qoip_dicts[QOIP_DICT_MAX];
+static int qoip_dicts_cnt = 0, qoip_dicts_default = -1, qoip_dic_tried = 0;
+
+/* Id of a dictionary, the one ZSTD stores in trained dictionaries or a hash of
+the content for raw ones. Never 0 */
+static u32 qoip_dict_id(const void *dict, const size_t dict_cnt) {
+	const unsigned char *bytes = (const unsigned char *)dict;
+	u32 id = ZDICT_getDictID(dict, dict_cnt);
+	size_t i;
+	if(!id) {
+		id = 2166136261u;
+		for(i=0;i<dict_cnt;++i)
+			id = (id ^ bytes[i]) * 16777619u;
+	}
+	return id ? id : 1;
+}
+
+int qoip_dict_add(const void *dict, const size_t dict_cnt, u32 *id) {
+	qoip_dict_t *n;
+	const u32 nid = dict ? qoip_dict_id(dict, dict_cnt) : 0;
+	int i;
+	if(dict == NULL || dict_cnt == 0)
+		return qoip_ret(69, stderr, "qoip_dict_add: Bad arguments");
+	for(i=0;i<qoip_dicts_cnt && qoip_dicts[i].id!=nid;++i);
+	if(i==qoip_dicts_cnt) {
+		if(qoip_dicts_cnt==QOIP_DICT_MAX)
+			return qoip_ret(70, stderr, "qoip_dict_add: Too many dictionaries");
+		n = qoip_dicts + i;
+		n->dict = malloc(dict_cnt);
+		n->cdict = ZSTD_createCDict(dict, dict_cnt, QOIP_ZSTD_LEVEL);
+		n->ddict = ZSTD_createDDict(dict, dict_cnt);
+		if(!n->dict || !n->cdict || !n->ddict) {
+			free(n->dict);
+			ZSTD_freeCDict(n->cdict);
+			ZSTD_freeDDict(n->ddict);
+			return qoip_ret(71, stderr, "qoip_dict_add: Failed to digest dictionary");
+		}
+		memcpy(n->dict, dict, dict_cnt);
+		n->dict_cnt = dict_cnt;
+		n->id = nid;
+		++qoip_dicts_cnt;
+	}
+	qoip_dicts_default = i;
+	if(id)
+		*id = nid;
+	return 0;
+}
+
+void qoip_dict_clear(void) {
+	int i;
+	for(i=0;i<qoip_dicts_cnt;++i) {
+		free(qoip_dicts[i].dict);
+		ZSTD_freeCDict(qoip_dicts[i].cdict);
+		ZSTD_freeDDict(qoip_dicts[i].ddict);
+	}
+	qoip_dicts_cnt = 0;
+	qoip_dicts_default = -1;
+	qoip_dic_tried = 0;
+}
+
+/* Add the dictionary file from before dictionaries could be added, once */
 static int qoip_dic_load() {
 	FILE *io;
-	if(!qoip_dic_loaded) {
-		io = fopen("dictionary", "rb");
-		if(!io)
-			return qoip_ret(1, stdout, "qoip_entropy: Failed to open dictionary\n");
-		if(fread(qoip_dic, 1, qoip_dic_cnt, io)!=qoip_dic_cnt) {
-			fclose(io);
-			return qoip_ret(2, stdout, "qoip_entropy: Failed to load dictionary\n");
-		}
+	void *dic;
+	long dic_cnt;
+	int ret;
+	if(qoip_dic_tried)
+		return 1;
+	qoip_dic_tried = 1;
+	if( !(io = fopen("dictionary", "rb")) )
+		return qoip_ret(1, stdout, "qoip_entropy: Failed to open dictionary\n");
+	fseek(io, 0, SEEK_END);
+	dic_cnt = ftell(io);
+	rewind(io);
+	if(dic_cnt <= 0 || !(dic = malloc(dic_cnt)) || fread(dic, 1, dic_cnt, io)!=(size_t)dic_cnt) {
+		if(dic_cnt > 0)
+			free(dic);
 		fclose(io);
-		qoip_dic_loaded=1;
+		return qoip_ret(2, stdout, "qoip_entropy: Failed to load dictionary\n");
+	}
+	fclose(io);
+	ret = qoip_dict_add(dic, dic_cnt, NULL);
+	free(dic);
+	return ret;
+}
+
+/* Added dictionary by id, or the default for id 0. NULL if there is none */
+static const qoip_dict_t *qoip_dict_find(const u32 id) {
+	int i;
+	if(!qoip_dicts_cnt)
+		qoip_dic_load();
+	if(!id)
+		return qoip_dicts_default==-1 ? NULL : qoip_dicts + qoip_dicts_default;
+	for(i=0;i<qoip_dicts_cnt;++i) {
+		if(qoip_dicts[i].id==id)
+			return qoip_dicts + i;
+	}
+	return NULL;
+}
+
+int qoip_dict_train(void *dict, size_t *dict_cnt, const void *const *files, const size_t *file_lens, const size_t cnt) {
+	unsigned char *samples;
+	size_t *sizes, i, p, total = 0, ret;
+	qoip_desc desc;
+	if(dict == NULL || dict_cnt == NULL || files == NULL || file_lens == NULL || cnt == 0)
+		return qoip_ret(72, stderr, "qoip_dict_train: Bad arguments");
+	/* Samples are what the entropy coder sees, the bitstreams */
+	for(i=0;i<cnt;++i) {
+		p = 0;
+		if(qoip_read_header(files[i], file_lens[i], &p, &desc) || desc.entropy || p + desc.raw_cnt > file_lens[i])
+			return qoip_ret(73, stderr, "qoip_dict_train: Files must be QOIP without entropy coding");
+		total += desc.raw_cnt;
+	}
+	sizes = malloc(cnt * sizeof(size_t));
+	samples = malloc(total ? total : 1);
+	if(!sizes || !samples) {
+		free(sizes);
+		free(samples);
+		return qoip_ret(74, stderr, "qoip_dict_train: Failed to allocate samples");
 	}
+	for(i=0,total=0;i<cnt;++i) {
+		p = 0;
+		qoip_read_header(files[i], file_lens[i], &p, &desc);
+		memcpy(samples + total, (const unsigned char *)files[i] + p, desc.raw_cnt);
+		sizes[i] = desc.raw_cnt;
+		total += desc.raw_cnt;
+	}
+	ret = ZDICT_trainFromBuffer(dict, *dict_cnt, samples, sizes, cnt);
+	free(samples);
+	free(sizes);
+	if(ZDICT_isError(ret))
+		return qoip_ret(75, stderr, "qoip_dict_train: ZSTD dictionary training failed");
+	*dict_cnt = ret;
 	return 0;
 }
 
-/* Bolted-on entropy encoding implementation, this way it can be reused */
-static int qoip_entropy(void *out, size_t *out_len, void *scratch, const int entropy) {
-	unsigned char *ptr = (unsigned char*)out;
-	int ret;
-	size_t p = 0, src_cnt, dst_cnt, loc_bithead, loc_bitstream;
-	ZSTD_CCtx *cctx;
-	qoip_desc d;
+/* LZ4 len bytes of src into dst, returning the compressed size or 0 if it
+doesn't fit in cap bytes */
+static size_t qoip_entropy_lz4(const unsigned char *src, unsigned char *dst, const size_t len, const size_t cap, const int level, void *lz4_state, void *lz4hc_state) {
+	if(level > 0) {/* HC */
+		if(lz4hc_state)
+			return LZ4_compress_HC_extStateHC(lz4hc_state, (const char *)src, (char *)dst, len, cap, level);
+		return LZ4_compress_HC((const char *)src, (char *)dst, len, cap, level);
+	}
+	if(lz4_state)
+		return LZ4_compress_fast_extState(lz4_state, (const char *)src, (char *)dst, len, cap, level ? -level : 1);
+	return LZ4_compress_fast((const char *)src, (char *)dst, len, cap, level ? -level : 1);
+}
 
-	qoip_read_file_header(out, &p, &d);
-	loc_bithead = p;
-	qoip_skip_bitstream_header(out, &p, &d);
-	loc_bitstream = p;
-	src_cnt = *out_len - p;
+/* Chunk size a src_cnt byte bitstream is entropy coded in, 0 for one piece.
+Chunks are needed past LZ4_MAX_INPUT_SIZE, otherwise only on request */
+static size_t qoip_entropy_chunk(const int entropy, const size_t src_cnt, size_t chunk) {
+	if(entropy==QOIP_ENTROPY_NONE)
+		return 0;
+	if(!chunk && entropy==QOIP_ENTROPY_LZ4 && src_cnt > LZ4_MAX_INPUT_SIZE)
+		chunk = QOIP_ENTROPY_CHUNK_LZ4;
+	else if(chunk && chunk < QOIP_ENTROPY_CHUNK_MIN)
+		chunk = QOIP_ENTROPY_CHUNK_MIN;
+	else if(chunk > LZ4_MAX_INPUT_SIZE)
+		chunk = QOIP_ENTROPY_CHUNK_LZ4;
+	return chunk < src_cnt ? chunk : 0;
+}
+
+/* Entropy code the src_cnt byte bitstream at src into dst in chunks of chunk
+bytes. Sets *dst_cnt, or 0 if the result would not fit in cap bytes. *dict_id is
+the dictionary used. Returns >0 on failure */
+static int qoip_entropy_compress(const unsigned char *src, const size_t src_cnt, unsigned char *dst, const size_t cap, size_t *dst_cnt, const int entropy, const qoip_entropy_ctx_t *ctx, const size_t chunk, u32 *dict_id) {
+	size_t i, t, len, chunk_cnt, n = 0;
+	ZSTD_CCtx *cctx = ctx ? ctx->cctx : NULL;
+	void *lz4_state = ctx ? ctx->lz4_state : NULL, *lz4hc_state = ctx ? ctx->lz4hc_state : NULL;
+	const ZSTD_CDict *cdict = ctx ? ctx->cdict : NULL;
+	const void *dict_bytes = ctx ? ctx->dict : NULL;
+	size_t dict_cnt = ctx ? ctx->dict_cnt : 0;
+	const qoip_dict_t *dict;
+	const int level = ctx ? ctx->level : 0, threads = ctx ? ctx->threads : 0;
+	ZSTD_inBuffer zin = {src, src_cnt, 0};
+	ZSTD_outBuffer zout = {dst, cap, 0};
+
+	*dict_id = ctx ? ctx->dict_id : 0;
+	*dst_cnt = 0;
+	/* Chunked data is a table of compressed chunk sizes, then the chunks each
+	compressed on their own so they can be decoded on their own */
+	chunk_cnt = chunk ? (src_cnt + chunk - 1) / chunk : 1;
+	if(chunk) {
+		n = (4 * chunk_cnt + 7) & ~(size_t)7;
+		if(n >= cap)
+			return 0;
+		for(t=4*chunk_cnt;t<n;)
+			dst[t++] = 0;
+	}
 	if(entropy==QOIP_ENTROPY_LZ4) {
-		if(src_cnt > LZ4_MAX_INPUT_SIZE)
-			return qoip_ret(3, stdout, "qoip_entropy: Data too big for LZ4, not using entropy (use external LZ4 instead and bug maintainer to implement the advanced API)\n");
-		dst_cnt = LZ4_compress_default((char *)ptr+p, scratch, src_cnt, LZ4_compressBound(src_cnt));
-		if(dst_cnt==0)
-			return qoip_ret(4, stdout, "qoip_entropy: LZ4 compression failed\n");
-	}
-	else if(entropy==QOIP_ENTROPY_ZSTD) {
-		dst_cnt = ZSTD_compress(scratch, ZSTD_compressBound(src_cnt), ptr+p, src_cnt, 19);
-		if(ZSTD_isError(dst_cnt))
-			return qoip_ret(5, stdout, "qoip_entropy: ZSTD compression failed\n");
+		for(i=0;i<chunk_cnt;++i) {
+			len = chunk && src_cnt - i*chunk > chunk ? chunk : src_cnt - i*chunk;
+			if( !(t = qoip_entropy_lz4(src + i*chunk, dst + n, len, cap - n, level, lz4_state, lz4hc_state)) )
+				return 0;
+			n += t;
+			if(chunk) {
+				len = 4*i;
+				qoip_write_32(dst, &len, t);
+			}
+		}
 	}
-	else if(entropy==QOIP_ENTROPY_ZSTD_DICTIONARY) {
-		cctx = ZSTD_createCCtx();
-		if((ret=qoip_dic_load()))
-			return ret;
-		dst_cnt = ZSTD_compress_usingDict(cctx, scratch, ZSTD_compressBound(src_cnt), ptr+p, src_cnt, qoip_dic, qoip_dic_cnt, 19);
-		ZSTD_freeCCtx(cctx);
-		if(ZSTD_isError(dst_cnt))
-			return qoip_ret(6, stdout, "qoip_entropy: ZSTD dictionary compression failed\n");
+	else if(entropy==QOIP_ENTROPY_ZSTD || entropy==QOIP_ENTROPY_ZSTD_DICTIONARY) {
+		if(entropy==QOIP_ENTROPY_ZSTD_DICTIONARY && !cdict) {
+			if( !(dict = qoip_dict_find(0)) )
+				return qoip_ret(76, stdout, "qoip_entropy: No dictionary, add one with qoip_dict_add\n");
+			cdict = dict->cdict;
+			dict_bytes = dict->dict;
+			dict_cnt = dict->dict_cnt;
+			*dict_id = dict->id;
+		}
+		if(!cctx && !(cctx = ZSTD_createCCtx()))
+			return qoip_ret(3, stdout, "qoip_entropy: Failed to create ZSTD context\n");
+		/* Streamed in one call so output that doesn't fit in cap stops the frame
+		instead of being an error */
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level ? level : QOIP_ZSTD_LEVEL);
+		if(threads > 1) {
+			/* nbWorkers is refused by single threaded libzstd builds, which then
+			compress on this thread. The default job size is several times the
+			window, more than most images, so split the bitstream between the
+			workers. zstd raises it to its minimum */
+			len = chunk ? chunk : src_cnt;
+			ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads);
+			ZSTD_CCtx_setParameter(cctx, ZSTD_c_jobSize, (int)(len / threads < (1<<30) ? len / threads + 1 : (1<<30)));
+		}
+		/* A CDict's level overrides the context's, so other levels digest the
+		dictionary for the call instead */
+		if(cdict && (!level || level==QOIP_ZSTD_LEVEL || !dict_bytes))
+			ZSTD_CCtx_refCDict(cctx, cdict);
+		else if(cdict)
+			ZSTD_CCtx_loadDictionary(cctx, dict_bytes, dict_cnt);
+		/* Each chunk is a frame of its own, a new one starts once the last ends */
+		zout.pos = n;
+		for(i=0,t=0;i<chunk_cnt && !t;++i) {
+			len = zout.pos;
+			zin.size = chunk && src_cnt - i*chunk > chunk ? (i+1)*chunk : src_cnt;
+			do
+				t = ZSTD_compressStream2(cctx, &zout, &zin, ZSTD_e_end);
+			while(!ZSTD_isError(t) && t && zout.pos < zout.size);
+			if(chunk && !t) {
+				n = 4*i;
+				qoip_write_32(dst, &n, zout.pos - len);
+			}
+		}
+		ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+		if(!ctx || !ctx->cctx)
+			ZSTD_freeCCtx(cctx);
+		if(ZSTD_isError(t)) {
+			if(cdict)
+				return qoip_ret(6, stdout, "qoip_entropy: ZSTD dictionary compression failed\n");
+			return qoip_ret(5, stdout, "qoip_entropy: ZSTD compression failed\n");
+		}
+		n = t ? 0 : zout.pos;/* Not finished means out of room */
 	}
 	else
 		return qoip_ret(7, stdout, "qoip_entropy: Requested entropy coding unknown, update encoder?");
+	*dst_cnt = n;
+	return 0;
+}
+
+/* Write the entropy fields following raw_cnt in the file header at bytes, and
+the entropy byte */
+static void qoip_entropy_write_fields(unsigned char *bytes, const int entropy, const size_t dst_cnt, const u32 dict_id, const size_t chunk, const size_t src_cnt) {
+	size_t p = 24;
+	qoip_write_64(bytes + 16, dst_cnt);
+	if(entropy==QOIP_ENTROPY_ZSTD_DICTIONARY) {
+		qoip_write_64(bytes + p, dict_id);
+		p += 8;
+	}
+	if(chunk) {
+		qoip_write_32(bytes, &p, chunk);
+		qoip_write_32(bytes, &p, (src_cnt + chunk - 1) / chunk);
+	}
+	bytes[6] = entropy | (chunk ? QOIP_ENTROPY_CHUNKED : 0) | (entropy==QOIP_ENTROPY_ZSTD_DICTIONARY ? QOIP_ENTROPY_DICT_ID : 0);
+}
+
+/* Entropy code the raw_len byte file at raw, whose bitstream starts at
+loc_bitstream, straight into its final place in out. The headers are copied
+around the entropy fields so nothing is shifted afterwards. If entropy coding
+doesn't make it smaller the file is copied as is. Returns >0 on failure */
+static int qoip_entropy_copy(const unsigned char *raw, const size_t raw_len, const size_t loc_bitstream, unsigned char *out, size_t *out_len, const int entropy, const qoip_entropy_ctx_t *ctx) {
+	const size_t src_cnt = raw_len - loc_bitstream;
+	const size_t chunk = qoip_entropy_chunk(entropy, src_cnt, ctx ? ctx->chunk : 0);
+	const size_t extra = qoip_entropy_fields_size(entropy==QOIP_ENTROPY_ZSTD_DICTIONARY, chunk);
+	size_t p, dst_cnt = 0;
+	u32 dict_id;
+	int ret = 0;
+	/* Only worth it if the entropy fields and padding are paid for */
+	if(src_cnt + 8 > extra)
+		ret = qoip_entropy_compress(raw + loc_bitstream, src_cnt, out + loc_bitstream + extra, src_cnt + 7 - extra, &dst_cnt, entropy, ctx, chunk, &dict_id);
+	if(ret || !dst_cnt) {
+		memcpy(out, raw, raw_len);
+		*out_len = raw_len;
+		return ret;
+	}
+	memcpy(out, raw, 16);
+	memcpy(out + 16 + extra, raw + 16, loc_bitstream - 16);
+	qoip_entropy_write_fields(out, entropy, dst_cnt, dict_id, chunk, src_cnt);
+	for(p = loc_bitstream + extra + dst_cnt;p%8;)
+		out[p++]=0;
+	*out_len = p;
+	return 0;
+}
+
+/* Bolted-on entropy encoding implementation, this way it can be reused. out is
+entropy coded in place through scratch, which needs room for the bitstream */
+static inline int qoip_entropy(void *out, size_t *out_len, void *scratch, const int entropy, const qoip_entropy_ctx_t *ctx) {
+	unsigned char *ptr = (unsigned char*)out, *tmp = (unsigned char *)scratch;
+	size_t p = 0, src_cnt, dst_cnt = 0, loc_bitstream, chunk, extra;
+	u32 dict_id;
+	int ret;
+	qoip_desc d;
 
-	if(dst_cnt<src_cnt) {
-		for(p=loc_bitstream-1;p>=loc_bithead;--p)/*Shift bitstream header for entropy_cnt*/
-			ptr[p+8] = ptr[p];
-		qoip_write_64(ptr+loc_bithead, dst_cnt);
-		for(p=0;p<dst_cnt;++p)
-			ptr[loc_bitstream + 8 + p] = ((unsigned char *)scratch)[p];
-		p = loc_bitstream + 8 + dst_cnt;
-		for(;p%8;)
+	qoip_read_file_header(out, *out_len, &p, &d);
+	qoip_skip_bitstream_header(out, &p, &d);
+	loc_bitstream = p;
+	src_cnt = *out_len - p;
+	chunk = qoip_entropy_chunk(entropy, src_cnt, ctx ? ctx->chunk : 0);
+	extra = qoip_entropy_fields_size(entropy==QOIP_ENTROPY_ZSTD_DICTIONARY, chunk);
+	if(src_cnt + 8 <= extra)
+		return 0;
+	if((ret=qoip_entropy_compress(ptr + loc_bitstream, src_cnt, tmp, src_cnt + 7 - extra, &dst_cnt, entropy, ctx, chunk, &dict_id)))
+		return ret;
+	if(dst_cnt) {
+		memmove(ptr + 16 + extra, ptr + 16, loc_bitstream - 16);/* Strip table and bitstream header */
+		qoip_entropy_write_fields(ptr, entropy, dst_cnt, dict_id, chunk, src_cnt);
+		memcpy(ptr + loc_bitstream + extra, tmp, dst_cnt);
+		for(p = loc_bitstream + extra + dst_cnt;p%8;)
 			ptr[p++]=0;
 		*out_len = p;
-		ptr[6]=entropy;
 	}
 	return 0;
 }
 
-int qoip_stat(const void *encoded, FILE *io) {
+int qoip_stat(const void *encoded, const size_t len, FILE *io) {
 	int i, op_cnt;
 	const opdef_t *opdef;
 	qoip_desc desc;
@@ -731,9 +1465,9 @@ int qoip_stat(const void *encoded, FILE *io) {
 	size_t p = 0, raw;
 	const unsigned char *bytes = (const unsigned char *) encoded;
 
-	if(qoip_read_file_header(bytes, &p, &desc))
+	if(qoip_read_file_header(bytes, len, &p, &desc))
 		return qoip_ret(8, stderr, "qoip_stat: Failed to read file header");
-	if(qoip_read_bitstream_header(bytes, &p, &desc, ops, &op_cnt))
+	if(qoip_read_bitstream_header(bytes, &p, &desc, ops, &op_cnt) || qoip_strip_cnt_invalid(bytes, &desc))
 		return qoip_ret(9, stderr, "qoip_stat: Failed to read bitstream header");
 	if(qoip_expand_opcodes(&op_cnt, ops, q))
 		return qoip_ret(10, stderr, "qoip_stat: Failed to expand opstring");
@@ -749,9 +1483,23 @@ int qoip_stat(const void *encoded, FILE *io) {
 		fprintf(io, "Entropy coding: LZ4\n");
 	else if(desc.entropy==QOIP_ENTROPY_ZSTD)
 		fprintf(io, "Entropy coding: ZSTD\n");
+	else if(desc.entropy==QOIP_ENTROPY_ZSTD_DICTIONARY)
+	{
+		if(desc.dict_id)
+			fprintf(io, "Entropy coding: ZSTD with dictionary %08"PRIx32"\n", desc.dict_id);
+		else
+			fprintf(io, "Entropy coding: ZSTD with the default dictionary\n");
+	}
 	else
 		fprintf(io, "Entropy coding: Unknown\n");
 
+	if(desc.entropy_chunk)
+		fprintf(io, "Entropy chunks: %"PRIu32" of %"PRIu32" bytes\n", qoip_entropy_chunk_cnt(&desc), desc.entropy_chunk);
+	if(desc.strip_height)
+		fprintf(io, "Layout: %"PRIu32" strips of %"PRIu32" rows\n", qoip_strip_cnt(&desc), desc.strip_height);
+	else
+		fprintf(io, "Layout: Single bitstream\n");
+
 	raw = desc.width*desc.height*desc.channels;
 	fprintf(io,   "Raw size:                   %9zu\n", raw);
 	if(desc.raw_cnt)
@@ -784,13 +1532,15 @@ int qoip_stat(const void *encoded, FILE *io) {
 	return 0;
 }
 
+/* Emit the external definition here, so calls the compiler doesn't inline link */
+extern inline void qoip_gen_var_rgb(qoip_working_t *restrict q);
 inline void qoip_gen_var_rgb(qoip_working_t *restrict q) {
-	if (q->px_w<8192) {
-		q->px_ref.rgba.r = (q->px_prev.rgba.r + q->upcache[(q->px_w * 3) + 0]+1) >> 1;
-		q->px_ref.rgba.g = (q->px_prev.rgba.g + q->upcache[(q->px_w * 3) + 1]+1) >> 1;
-		q->px_ref.rgba.b = (q->px_prev.rgba.b + q->upcache[(q->px_w * 3) + 2]+1) >> 1;
+	if (q->px_pos >= q->stride) {
+		q->px_ref.rgba.r = (q->px_prev.rgba.r + q->in[q->px_pos - q->stride + 0]+1) >> 1;
+		q->px_ref.rgba.g = (q->px_prev.rgba.g + q->in[q->px_pos - q->stride + 1]+1) >> 1;
+		q->px_ref.rgba.b = (q->px_prev.rgba.b + q->in[q->px_pos - q->stride + 2]+1) >> 1;
 	}
-	else
+	else/* The first row predicts from the previous pixel, like the decoder */
 		q->px_ref.v = q->px_prev.v;
 	q->vr = q->px.rgba.r - q->px_prev.rgba.r;
 	q->vg = q->px.rgba.g - q->px_prev.rgba.g;
@@ -802,41 +1552,7 @@ inline void qoip_gen_var_rgb(qoip_working_t *restrict q) {
 	q->avg_gb = q->avg_b - q->avg_g;
 }
 
-/* fastpath definitions */
-#include "qoip-fast.c"
-typedef struct {
-	u8 opstr[16];
-	int (*enc)(qoip_working_t*, size_t*, void*, int);
-	int (*dec)(qoip_working_t*);
-} qoip_fastpath_t;
-
-int qoip_fastpath_cnt = 2;
-/*Refactor from opstring to bytestring ids when fixing as opstr has been removed*/
-static const qoip_fastpath_t qoip_fastpath[] = {
-	{{9, OP_LUMA1_232B, OP_LUMA2_464, OP_INDEX5, OP_LUMA3_676, OP_INDEX10, OP_LUMA4_6866, OP_LUMA2_2322, OP_LUMA3_4544, OP_A}, qoip_encode_effort0, qoip_decode_effort0},
-	{{5, OP_LUMA1_232, OP_LUMA2_454, OP_LUMA2_3433, OP_LUMA3_5655, OP_LUMA3_676}, qoip_encode_fast1, qoip_decode_fast1},
-};
-
-static inline int qoip_fastpath_match(const u8 *key, const qoip_fastpath_t *fast) {
-	int i;
-	for (i=0;i<=key[0];++i) {
-		if (key[i]!=fast->opstr[i])
-			return 1;
-	}
-	return 0;
-}
-
-static inline int qoip_fastpath_find(const u8 *key) {
-	int i;
-	for (i=0;i<qoip_fastpath_cnt;++i) {
-		if (qoip_fastpath_match(key, qoip_fastpath + i) == 0)
-			return i;
-	}
-	return -1;
-}
-
 void qoip_init_working_memory(qoip_working_t *restrict q, const void *data, const qoip_desc *desc) {
-	int i;
 	q->in = (const unsigned char *)data;
 	q->px.v = 0;
 	q->px.rgba.a = 255;
@@ -844,15 +1560,6 @@ void qoip_init_working_memory(qoip_working_t *restrict q, const void *data, cons
 	q->height = desc->height;
 	q->channels = desc->channels;
 	q->stride = desc->width * desc->channels;
-	q->index2_maxval=1023;
-	q->upcache[0]=0;
-	q->upcache[1]=0;
-	q->upcache[2]=0;
-	for(i=0;i<(desc->width<8192?desc->width-1:8191);++i) {/* Prefill upcache */
-		q->upcache[((i+1)*3)+0]=q->in[(i*desc->channels)+0];
-		q->upcache[((i+1)*3)+1]=q->in[(i*desc->channels)+1];
-		q->upcache[((i+1)*3)+2]=q->in[(i*desc->channels)+2];
-	}
 }
 
 /* Pick which generic path to take
@@ -871,48 +1578,44 @@ static inline int qoip_generic_path_index(const qoip_opcode_t *op, const int op_
 	return ret;
 }
 
-#define QOIP_ENCODE_INNER(aaa, bbb)                 \
+/* Try ops in set order, 1 if one of them encoded the pixel */
+static inline int qoip_encode_ops(qoip_working_t *restrict q, qoip_opcode_t *op, const int op_cnt) {
+	int i;
+	for(i=0;i<op_cnt;++i){
+		if(op[i].enc(q, op[i].opcode)) {
+			op[i].freq++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* ops is an expression that encodes the pixel and evaluates to non-zero, or
+evaluates to zero so the pixel is encoded as RGB/RGBA. Generated fastpaths pass
+a chain of direct op calls, the generic path passes qoip_encode_ops */
+#define QOIP_ENCODE_INNER_OPS(aaa, bbb, ops)        \
 	do {                                              \
-		int i;                                          \
 		if (q->px.v == q->px_prev.v)                    \
-			++q->run;                                     \
+			qoip_extend_run(q);                           \
 		else {                                          \
 			qoip_encode_run(q);                           \
 			if((aaa) || (bbb))                            \
 				q->hash = QOIP_COLOR_HASH(q->px);           \
 			qoip_gen_var_rgb(q);                          \
 			q->va = q->px.rgba.a - q->px_prev.rgba.a;     \
-			for(i=0;i<op_cnt;++i){                        \
-				if(op[i].enc(q, op[i].opcode)) {            \
-					op[i].freq++;                             \
-					break;                                    \
-				}                                           \
-			}                                             \
-			if(i==op_cnt) {                               \
-				if(q->va==0) {                              \
-					q->out[q->p++] = q->rgb_opcode;           \
-					q->out[q->p++] = q->px.rgba.r;            \
-					q->out[q->p++] = q->px.rgba.g;            \
-					q->out[q->p++] = q->px.rgba.b;            \
-				}                                           \
-				else {                                      \
-					q->out[q->p++] = q->rgba_opcode;          \
-					q->out[q->p++] = q->px.rgba.r;            \
-					q->out[q->p++] = q->px.rgba.g;            \
-					q->out[q->p++] = q->px.rgba.b;            \
-					q->out[q->p++] = q->px.rgba.a;            \
-				}                                           \
+			if(!(ops)) {                                  \
+				if(q->va==0)                                \
+					qoip_write_op(q, QOIP_OP_RGB(q->rgb_opcode, q->px), 4); \
+				else                                        \
+					qoip_write_op(q, QOIP_OP_RGBA(q->rgba_opcode, q->px), 5); \
 			}                                             \
 		}                                               \
-		if(q->px_w<8192) {                              \
-			q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r; \
-			q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g; \
-			q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b; \
-		}                                               \
 		if((aaa)==1)                                    \
 			q->index2[q->hash & q->index2_maxval] = q->px; \
 	} while (0)
 
+#define QOIP_ENCODE_INNER(aaa, bbb) QOIP_ENCODE_INNER_OPS(aaa, bbb, qoip_encode_ops(q, op, op_cnt))
+
 #define QOIP_ENCODE_LOOP(inner)                     \
 	do {                                              \
 		if(q->channels==4) {                            \
@@ -941,83 +1644,21 @@ static inline int qoip_generic_path_index(const qoip_opcode_t *op, const int op_
 		}                                               \
 	} while (0)
 
-int qoip_encode(const void *data, const qoip_desc *desc, void *out, size_t *out_len, const char *opstring, const int entropy, void *scratch) {
-	int fast, i, op_cnt = 0;
-	qoip_working_t qq = {0};
-	qoip_working_t *restrict q = &qq;
-	qoip_opcode_t op[OP_END];
-	int generic_path_choice = 0;
-	q->out = (unsigned char *)out;
-	qoip_init_working_memory(q, data, desc);
-
-	if (
-		data == NULL || desc == NULL || out == NULL || out_len == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 || desc->colorspace > 1
-	)
-		return qoip_ret(12, stderr, "qoip_encode: Bad arguments");
-	if (entropy && !scratch)
-		return qoip_ret(13, stderr, "qoip_encode: Scratch space needs to be provided for entropy encoding");
-
-	if(opstring == NULL || *opstring==0)
-		opstring = "02244082a0a6c4c5e2";
-	if(parse_opstring(opstring, op, &op_cnt))
-		return qoip_ret(14, stderr, "qoip_encode: Failed to parse opstring");
-	if(qoip_expand_opcodes(&op_cnt, op, q))
-		return qoip_ret(15, stderr, "qoip_encode: Failed to expand opstring");
-	qoip_write_file_header(q->out, &(q->p), desc);
-	qoip_write_bitstream_header(q->out, &q->p, desc, op, op_cnt);
-	q->bitstream_loc = q->p;
-	q->px_pos = 0;
-
-	if ((fast=qoip_fastpath_find(q->out+25))!=-1 && qoip_fastpath[fast].enc)
-		return qoip_fastpath[fast].enc(q, out_len, scratch, entropy);
+/* Generic decode of the explicit ops, one indexed call on the first byte */
+#define QOIP_DECODE_OPS dispatch[q->in[q->p]].dec(q)
 
-	/* Sort ops into order they should be tested on encode */
-	qoip_sort_set(op, op_cnt);
-
-	/* Determine correct generic path and take it */
-	generic_path_choice = qoip_generic_path_index(op, op_cnt);
-	if(generic_path_choice==0)
-		QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(0, 0));
-	else if(generic_path_choice==1)
-		QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(0, 1));
-	else if(generic_path_choice==3)
-		QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(1, 0));
-	else if(generic_path_choice==4)
-		QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(1, 1));
-	else if(generic_path_choice==2)
-		QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(0, 2));
-	else if(generic_path_choice==5)
-		QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(1, 2));
-
-	qoip_encode_run(q);/* Cap off ending run if present*/
-	qoip_finish(q);
-	*out_len = q->p;
-
-	/*Sort ops into frequency order for quicker generic decode*/
-	/*A streaming encoder would skip this as it requires modifying the header*/
-	qsort(op, op_cnt, sizeof(qoip_opcode_t), opcode_comp_freq);
-	for(i=0;i<op_cnt;++i)
-		q->out[26+i] = op[i].id;
-
-	if(entropy)
-		qoip_entropy(out, out_len, scratch, entropy);
-	return 0;
-}
-
-/*Decode loop for 1 byte FIFO present present, 2 byte hash maybe present*/
-#define QOIP_DECODE_INNERF(aaa)                     \
+/*Decode loop for 1 byte FIFO present present, 2 byte hash maybe present. ops is
+a statement decoding any explicit op other than the index1 op*/
+#define QOIP_DECODE_INNERF_OPS(aaa, ops)            \
 	do {                                              \
-		int i;                                          \
 		if (q->run > 0)                                 \
-			--q->run;                                     \
+			qoip_expand_run(q);                           \
 		else if (q->p < q->in_tot) {                    \
 			q->px_prev.v = q->px.v;                       \
-			if (q->px_pos >= q->stride && q->px_w<8192) { \
-				q->px_ref.rgba.r = (q->px.rgba.r + q->upcache[(q->px_w * 3) + 0] + 1) >> 1; \
-				q->px_ref.rgba.g = (q->px.rgba.g + q->upcache[(q->px_w * 3) + 1] + 1) >> 1; \
-				q->px_ref.rgba.b = (q->px.rgba.b + q->upcache[(q->px_w * 3) + 2] + 1) >> 1; \
+			if (q->px_pos >= q->stride) {                 \
+				q->px_ref.rgba.r = (q->px.rgba.r + q->out[q->px_pos - q->stride + 0] + 1) >> 1; \
+				q->px_ref.rgba.g = (q->px.rgba.g + q->out[q->px_pos - q->stride + 1] + 1) >> 1; \
+				q->px_ref.rgba.b = (q->px.rgba.b + q->out[q->px_pos - q->stride + 2] + 1) >> 1; \
 			}                                             \
 			else                                          \
 				q->px_ref.v = q->px_prev.v;                 \
@@ -1045,36 +1686,26 @@ int qoip_encode(const void *data, const qoip_desc *desc, void *out, size_t *out_
 				q->index[q->index_wpos++ & q->index1_maxval] = q->px; \
 			}                                             \
 			else {                                        \
-				for(i=0;i<op_cnt;++i) {                     \
-					if ((q->in[q->p] & op[i].mask) == op[i].opcode) { \
-						op[i].dec(q);                           \
-						break;                                  \
-					}                                         \
-				}                                           \
+				ops;                                        \
 				q->index[q->index_wpos++ & q->index1_maxval] = q->px; \
 			}                                             \
 			if((aaa)==1)                                  \
 				q->index2[QOIP_COLOR_HASH(q->px) & q->index2_maxval] = q->px; \
 		}                                               \
-		if(q->px_w<8192) {                              \
-			q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r; \
-			q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g; \
-			q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b; \
-		}                                               \
 	} while (0)
 
-/*Decode loop for hash indexing with none present, 1 or both present*/
-#define QOIP_DECODE_INNER(aaa, bbb)                 \
+/*Decode loop for hash indexing with none present, 1 or both present. ops is a
+statement decoding any explicit op*/
+#define QOIP_DECODE_INNER_OPS(aaa, bbb, ops)        \
 	do {                                              \
-		int i;                                          \
 		if (q->run > 0)                                 \
-			--q->run;                                     \
+			qoip_expand_run(q);                           \
 		else if (q->p < q->in_tot) {                    \
 			q->px_prev.v = q->px.v;                       \
-			if (q->px_pos >= q->stride && q->px_w<8192) { \
-				q->px_ref.rgba.r = (q->px.rgba.r + q->upcache[(q->px_w * 3) + 0] + 1) >> 1; \
-				q->px_ref.rgba.g = (q->px.rgba.g + q->upcache[(q->px_w * 3) + 1] + 1) >> 1; \
-				q->px_ref.rgba.b = (q->px.rgba.b + q->upcache[(q->px_w * 3) + 2] + 1) >> 1; \
+			if (q->px_pos >= q->stride) {                 \
+				q->px_ref.rgba.r = (q->px.rgba.r + q->out[q->px_pos - q->stride + 0] + 1) >> 1; \
+				q->px_ref.rgba.g = (q->px.rgba.g + q->out[q->px_pos - q->stride + 1] + 1) >> 1; \
+				q->px_ref.rgba.b = (q->px.rgba.b + q->out[q->px_pos - q->stride + 2] + 1) >> 1; \
 			}                                             \
 			else                                          \
 				q->px_ref.v = q->px_prev.v;                 \
@@ -1098,25 +1729,18 @@ int qoip_encode(const void *data, const qoip_desc *desc, void *out, size_t *out_
 				q->px.rgba.a = q->in[q->p++];               \
 			}                                             \
 			else {                                        \
-				for(i=0;i<op_cnt;++i) {                     \
-					if ((q->in[q->p] & op[i].mask) == op[i].opcode) { \
-						op[i].dec(q);                           \
-						break;                                  \
-					}                                         \
-				}                                           \
+				ops;                                        \
 			}                                             \
 			if((bbb)==1)                                  \
 				q->index[QOIP_COLOR_HASH(q->px)  & q->index1_maxval] = q->px; \
 			if((aaa)==1)                                  \
 				q->index2[QOIP_COLOR_HASH(q->px) & q->index2_maxval] = q->px; \
 		}                                               \
-		if(q->px_w<8192) {                              \
-			q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r; \
-			q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g; \
-			q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b; \
-		}                                               \
 	} while (0)
 
+#define QOIP_DECODE_INNERF(aaa)     QOIP_DECODE_INNERF_OPS(aaa, QOIP_DECODE_OPS)
+#define QOIP_DECODE_INNER(aaa, bbb) QOIP_DECODE_INNER_OPS(aaa, bbb, QOIP_DECODE_OPS)
+
 #define QOIP_DECODE_LOOP(inner)                     \
 	do {                                              \
 		if(q->channels==4) {                            \
@@ -1143,82 +1767,584 @@ int qoip_encode(const void *data, const qoip_desc *desc, void *out, size_t *out_
 		}                                               \
 	} while (0)
 
-int qoip_decode(const void *data, const size_t data_len, qoip_desc *desc, const int channels, void *out, void *scratch) {
-	int fast, i, j, op_cnt, ret;
-	qoip_working_t qq = {0};
+/* fastpath definitions, hand written then generated by qoip-fastgen.py */
+#include "qoip-fast.c"
+#include "qoip-fastgen.c"
+typedef struct {
+	u8 opstr[16];
+	int (*enc)(qoip_working_t*);
+	int (*dec)(qoip_working_t*);
+} qoip_fastpath_t;
+
+/* Keyed by op count then ids in id order. First match wins, so hand written
+fastpaths take precedence over generated ones */
+static const qoip_fastpath_t qoip_fastpath[] = {
+	{{9, OP_LUMA1_232B, OP_LUMA2_464, OP_INDEX5, OP_LUMA3_676, OP_INDEX10, OP_LUMA4_6866, OP_LUMA2_2322, OP_LUMA3_4544, OP_A}, qoip_encode_effort0, qoip_decode_effort0},
+	{{5, OP_LUMA1_232, OP_LUMA2_454, OP_LUMA2_3433, OP_LUMA3_5655, OP_LUMA3_676}, qoip_encode_fast1, qoip_decode_fast1},
+	QOIP_FASTGEN_TABLE
+};
+int qoip_fastpath_cnt = sizeof(qoip_fastpath) / sizeof(qoip_fastpath_t);
+
+static inline int qoip_fastpath_match(const u8 *key, const qoip_fastpath_t *fast) {
+	int i;
+	for (i=0;i<=key[0];++i) {
+		if (key[i]!=fast->opstr[i])
+			return 1;
+	}
+	return 0;
+}
+
+static inline int qoip_fastpath_find(const u8 *key) {
+	int i;
+	for (i=0;i<qoip_fastpath_cnt;++i) {
+		if (qoip_fastpath_match(key, qoip_fastpath + i) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Encode q->height rows from q->in + q->px_pos to q->out + q->p. Rows before
+px_pos are only read as the row above. A run still going at the last pixel is
+left in q->run */
+static void qoip_encode_pixels(qoip_working_t *restrict q, qoip_opcode_t *op, const int op_cnt, const int fast) {
+	int generic_path_choice;
+	if (fast!=-1)
+		qoip_fastpath[fast].enc(q);
+	else {
+		/* Determine correct generic path and take it */
+		generic_path_choice = qoip_generic_path_index(op, op_cnt);
+		if(generic_path_choice==0)
+			QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(0, 0));
+		else if(generic_path_choice==1)
+			QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(0, 1));
+		else if(generic_path_choice==3)
+			QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(1, 0));
+		else if(generic_path_choice==4)
+			QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(1, 1));
+		else if(generic_path_choice==2)
+			QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(0, 2));
+		else if(generic_path_choice==5)
+			QOIP_ENCODE_LOOP(QOIP_ENCODE_INNER(1, 2));
+	}
+}
+
+/* Encode the pixels of q->in to q->out + q->p, capping off the ending run and
+padding so that every bitstream (or strip) stands alone */
+static void qoip_encode_bitstream(qoip_working_t *restrict q, qoip_opcode_t *op, const int op_cnt, const int fast) {
+	q->px_pos = 0;
+	qoip_encode_pixels(q, op, op_cnt, fast);
+	qoip_encode_run(q);/* Cap off ending run if present*/
+	qoip_finish(q);
+}
+
+/* Encode each strip into its own worst-case sized region so strips can be done
+in parallel, then close the gaps. Each strip starts from freshly initialised
+state, q has the opcodes expanded but has not encoded anything */
+static int qoip_encode_strips(qoip_working_t *restrict q, qoip_opcode_t *op, const int op_cnt, const int fast, const size_t strip_height, const size_t loc_table) {
+	const size_t strip_cnt = (q->height + strip_height - 1) / strip_height;
+	const size_t region = strip_height * q->width * (q->channels + 1) + 16;
+	const size_t base = q->p;
+	size_t s, loc, off = 0, size;
+	#pragma omp parallel for schedule(dynamic)
+	for(s=0;s<strip_cnt;++s) {
+		int i;
+		qoip_working_t sq = *q;
+		qoip_tables_t st;
+		qoip_opcode_t sop[OP_END];
+		memcpy(sop, op, op_cnt * sizeof(qoip_opcode_t));
+		qoip_init_tables(&sq, &st, op, op_cnt, 1);
+		sq.in = q->in + s * strip_height * q->stride;
+		sq.height = (s==strip_cnt-1) ? q->height - s * strip_height : strip_height;
+		sq.out = q->out + base + s * region;
+		sq.p = 0;
+		qoip_encode_bitstream(&sq, sop, op_cnt, fast);
+		qoip_write_64(q->out + loc_table + 8*s, sq.p);/* Size for now, offset below */
+		for(i=0;i<op_cnt;++i) {
+			#pragma omp atomic
+			op[i].freq += sop[i].freq;
+		}
+	}
+	for(s=0;s<strip_cnt;++s) {
+		loc = loc_table + 8*s;
+		size = qoip_read_64(q->out, &loc);
+		if(off != s * region)
+			memmove(q->out + base + off, q->out + base + s * region, size);
+		qoip_write_64(q->out + loc_table + 8*s, off);
+		off += size;
+	}
+	q->p = base + off;
+	return 0;
+}
+
+/* Everything qoip_encode works out from the opstring before it looks at the
+image. qoip_encode fills one per call, qoip_encoder_create keeps one around */
+struct qoip_encoder {
+	qoip_working_t q;/* Zeroed state with the opcodes expanded */
+	qoip_opcode_t op[OP_END];/* Id order, as written to the bitstream header */
+	qoip_opcode_t enc_op[OP_END];/* Order the generic path tries them in */
+	int op_cnt, fast, entropy;
+	qoip_entropy_ctx_t ec;
+	ZSTD_CDict *cdict;/* Digested by qoip_encoder_set_dict */
+	void *dict;/* Its copy of the dictionary */
+	void *scratch;/* Grown by qoip_encoder_encode */
+	size_t scratch_cap;
+};
+
+static int qoip_encoder_init(qoip_encoder_t *restrict e, const char *opstring, const int entropy) {
+	u8 key[OP_END+1];
+	int i;
+	if(opstring == NULL || *opstring==0)
+		opstring = "02244082a0a6c4c5e2";
+	if(parse_opstring(opstring, e->op, &e->op_cnt))
+		return qoip_ret(14, stderr, "qoip_encode: Failed to parse opstring");
+	memset(&e->q, 0, sizeof(qoip_working_t));
+	if(qoip_expand_opcodes(&e->op_cnt, e->op, &e->q))
+		return qoip_ret(15, stderr, "qoip_encode: Failed to expand opstring");
+	key[0] = e->op_cnt;/* As the bitstream header has it */
+	for(i=0;i<e->op_cnt;++i)
+		key[i+1] = e->op[i].id;
+	memcpy(e->enc_op, e->op, e->op_cnt * sizeof(qoip_opcode_t));
+	if ((e->fast=qoip_fastpath_find(key))==-1 || !qoip_fastpath[e->fast].enc) {
+		e->fast = -1;
+		/* Sort ops into order they should be tested on encode */
+		qoip_sort_set(e->enc_op, e->op_cnt);
+	}
+	e->entropy = entropy;
+	e->ec.cctx = NULL;
+	e->ec.lz4_state = NULL;
+	e->ec.lz4hc_state = NULL;
+	e->ec.cdict = NULL;
+	e->ec.dict = NULL;
+	e->ec.dict_cnt = 0;
+	e->ec.dict_id = 0;
+	e->ec.level = 0;
+	e->ec.threads = 0;
+	e->ec.chunk = 0;
+	e->cdict = NULL;
+	e->dict = NULL;
+	e->scratch = NULL;
+	e->scratch_cap = 0;
+	return 0;
+}
+
+static int qoip_encode_ctx(const qoip_encoder_t *restrict e, const void *data, const qoip_desc *desc, void *out, size_t *out_len, void *scratch) {
+	int i, ret = 0;
+	size_t loc_table, loc_bithead;
+	qoip_working_t qq = e->q;
 	qoip_working_t *restrict q = &qq;
+	qoip_tables_t tables;
 	qoip_opcode_t op[OP_END];
-	int generic_path_choice = 0;
-
-	q->in = (const unsigned char *)data;
-	q->out = (unsigned char *)out;
+	qoip_entropy_ctx_t ec;
+	/* With entropy coding the raw file is encoded into scratch and entropy coded
+	from there straight to out. Room is left in front for the entropy fields so
+	the headers are copied once instead of shifted */
+	q->out = (unsigned char *)(e->entropy && scratch ? (unsigned char *)scratch + 24 : out);
 
 	if (
-		data == NULL || desc == NULL ||
-		(channels != 0 && channels != 3 && channels != 4) ||
-		data_len < QOIP_FILE_HEADER_SIZE
+		data == NULL || desc == NULL || out == NULL || out_len == NULL ||
+		desc->width == 0 || desc->height == 0 ||
+		desc->channels < 3 || desc->channels > 4 || desc->colorspace > 1
 	)
-		return qoip_ret(16, stderr, "qoip_decode: Bad arguments");
+		return qoip_ret(12, stderr, "qoip_encode: Bad arguments");
+	if (e->entropy && !scratch)
+		return qoip_ret(13, stderr, "qoip_encode: Scratch space needs to be provided for entropy encoding");
 
-	if(qoip_read_file_header(q->in, &(q->p), desc))
-		return qoip_ret(17, stderr, "qoip_decode: Failed to read file header");
-	if(qoip_read_bitstream_header(q->in, &(q->p), desc, op, &op_cnt))
-		return qoip_ret(18, stderr, "qoip_decode: Failed to read bitstream header");
-	/*Id order for opcode expansion*/
-	qsort(op, op_cnt, sizeof(qoip_opcode_t), opcode_comp_id);
-	if(qoip_expand_opcodes(&op_cnt, op, q))
-		return qoip_ret(19, stderr, "qoip_decode: Failed to expand opstring");
+	qoip_init_working_memory(q, data, desc);
+	memcpy(op, e->enc_op, e->op_cnt * sizeof(qoip_opcode_t));
+	loc_table = 24;/* Offsets follow strip_height and strip_cnt, entropy_cnt is inserted later */
+	qoip_write_file_header(q->out, &(q->p), desc);
+	loc_bithead = q->p;
+	qoip_write_bitstream_header(q->out, &q->p, desc, e->op, e->op_cnt);
+	q->bitstream_loc = q->p;
 
-	if(desc->entropy) {
-		if(!scratch)
-			return qoip_ret(20, stderr, "qoip_decode: Scratch space needs to be provided for entropy decoding");
-		if(desc->entropy==QOIP_ENTROPY_LZ4) {
-			if(LZ4_decompress_safe((char *)q->in + q->p, (char *)scratch, desc->entropy_cnt, desc->raw_cnt)!=desc->raw_cnt)
-				return qoip_ret(21, stderr, "qoip_decode: LZ4 decode failed");
+	if(desc->strip_height)
+		ret = qoip_encode_strips(q, op, e->op_cnt, e->fast, desc->strip_height, loc_table);
+	else {
+		qoip_init_tables(q, &tables, op, e->op_cnt, 1);
+		qoip_encode_bitstream(q, op, e->op_cnt, e->fast);
+	}
+	if(ret)
+		return ret;
+
+	/* Write bitstream size to file header, a streaming version might skip this step */
+	qoip_write_64(q->out+8, q->p-q->bitstream_loc);
+	*out_len = q->p;
+
+	/*Sort ops into frequency order for quicker generic decode*/
+	/*A streaming encoder would skip this as it requires modifying the header*/
+	if(e->fast==-1) {
+		qsort(op, e->op_cnt, sizeof(qoip_opcode_t), opcode_comp_freq);
+		for(i=0;i<e->op_cnt;++i)
+			q->out[loc_bithead+10+i] = op[i].id;
+	}
+
+	if(e->entropy) {
+		ec = e->ec;
+		ec.level = desc->entropy_level;
+		ec.threads = desc->entropy_threads;
+		ec.chunk = desc->entropy_chunk;
+		qoip_entropy_copy(q->out, q->p, q->bitstream_loc, out, out_len, e->entropy, &ec);
+	}
+	return 0;
+}
+
+/* Create the entropy coder context e needs, 1 on failure */
+static int qoip_encoder_alloc_entropy(qoip_encoder_t *restrict e) {
+	if(e->entropy==QOIP_ENTROPY_LZ4)
+		return !(e->ec.lz4_state = malloc(LZ4_sizeofState()));
+	if(e->entropy>=QOIP_ENTROPY_ZSTD)
+		return !(e->ec.cctx = ZSTD_createCCtx());
+	return 0;
+}
+
+/* Free what e has created, not e itself */
+static void qoip_encoder_release(qoip_encoder_t *restrict e) {
+	ZSTD_freeCCtx(e->ec.cctx);
+	free(e->ec.lz4_state);
+	free(e->ec.lz4hc_state);
+	ZSTD_freeCDict(e->cdict);
+	free(e->dict);
+	free(e->scratch);
+}
+
+int qoip_encode(const void *data, const qoip_desc *desc, void *out, size_t *out_len, const char *opstring, const int entropy, void *scratch) {
+	qoip_encoder_t e;
+	int ret;
+	if((ret=qoip_encoder_init(&e, opstring, entropy)))
+		return ret;
+	return qoip_encode_ctx(&e, data, desc, out, out_len, scratch);
+}
+
+int qoip_encoder_create(qoip_encoder_t **e, const char *opstring, const int entropy) {
+	qoip_encoder_t *n;
+	int ret;
+	if(e == NULL || entropy < 0 || entropy > QOIP_ENTROPY_ZSTD_DICTIONARY)
+		return qoip_ret(53, stderr, "qoip_encoder_create: Bad arguments");
+	if( !(n = malloc(sizeof(qoip_encoder_t))) )
+		return qoip_ret(54, stderr, "qoip_encoder_create: Failed to allocate context");
+	if((ret=qoip_encoder_init(n, opstring, entropy))) {
+		free(n);
+		return ret;
+	}
+	if(qoip_encoder_alloc_entropy(n)) {
+		qoip_encoder_free(n);
+		return qoip_ret(55, stderr, "qoip_encoder_create: Failed to allocate entropy context");
+	}
+	*e = n;
+	return 0;
+}
+
+int qoip_encoder_encode(qoip_encoder_t *e, const void *data, const qoip_desc *desc, void *out, size_t *out_len) {
+	size_t need;
+	void *p;
+	if(e == NULL || desc == NULL)
+		return qoip_ret(56, stderr, "qoip_encoder_encode: Bad arguments");
+	if(e->entropy && (need = qoip_maxentropysize(qoip_maxsize(desc), e->entropy)) > e->scratch_cap) {
+		if( !(p = realloc(e->scratch, need)) )
+			return qoip_ret(57, stderr, "qoip_encoder_encode: Failed to allocate scratch");
+		e->scratch = p;
+		e->scratch_cap = need;
+	}
+	if(e->entropy==QOIP_ENTROPY_LZ4 && desc->entropy_level > 0 && !e->ec.lz4hc_state && !(e->ec.lz4hc_state = malloc(LZ4_sizeofStateHC())))
+		return qoip_ret(78, stderr, "qoip_encoder_encode: Failed to allocate LZ4 HC state");
+	return qoip_encode_ctx(e, data, desc, out, out_len, e->scratch);
+}
+
+void qoip_encoder_free(qoip_encoder_t *e) {
+	if(e == NULL)
+		return;
+	qoip_encoder_release(e);
+	free(e);
+}
+
+int qoip_encoder_set_dict(qoip_encoder_t *e, const void *dict, const size_t dict_cnt) {
+	ZSTD_CDict *cdict;
+	void *copy;
+	if(e == NULL || dict == NULL || dict_cnt == 0)
+		return qoip_ret(68, stderr, "qoip_encoder_set_dict: Bad arguments");
+	if( !(copy = malloc(dict_cnt)) || !(cdict = ZSTD_createCDict(dict, dict_cnt, QOIP_ZSTD_LEVEL)) ) {
+		free(copy);
+		return qoip_ret(77, stderr, "qoip_encoder_set_dict: Failed to digest dictionary");
+	}
+	memcpy(copy, dict, dict_cnt);
+	ZSTD_freeCDict(e->cdict);
+	free(e->dict);
+	e->cdict = cdict;
+	e->dict = copy;
+	e->ec.cdict = cdict;
+	e->ec.dict = copy;
+	e->ec.dict_cnt = dict_cnt;
+	e->ec.dict_id = qoip_dict_id(dict, dict_cnt);
+	return 0;
+}
+
+/* Worst case an image takes in a batch, entropy coding can add entropy_cnt and
+padding when it does shrink the bitstream */
+static size_t qoip_batch_region(const qoip_desc *desc) {
+	return qoip_maxsize(desc) + 16;
+}
+
+size_t qoip_batch_maxsize(const qoip_batch_item_t *items, const size_t cnt) {
+	size_t i, size = 0;
+	for(i=0;i<cnt;++i)
+		size += qoip_batch_region(&items[i].desc);
+	return size;
+}
+
+int qoip_encode_batch(qoip_batch_item_t *items, const size_t cnt, const char *opstring, const int entropy, const int threads, void *out, size_t *out_len) {
+	qoip_encoder_t e;
+	const qoip_dict_t *dict;
+	unsigned char *bytes = (unsigned char *)out;
+	size_t i, base = 0, off = 0;
+	int ret, err = 0;
+	if(items == NULL || out == NULL || out_len == NULL || threads < 1 || entropy < 0 || entropy > QOIP_ENTROPY_ZSTD_DICTIONARY)
+		return qoip_ret(64, stderr, "qoip_encode_batch: Bad arguments");
+	if((ret=qoip_encoder_init(&e, opstring, entropy)))
+		return ret;
+	if(entropy==QOIP_ENTROPY_ZSTD_DICTIONARY && (dict = qoip_dict_find(0))) {
+		/* Looked up once here so threads don't race to load the dictionary file */
+		e.ec.cdict = dict->cdict;
+		e.ec.dict = dict->dict;
+		e.ec.dict_cnt = dict->dict_cnt;
+		e.ec.dict_id = dict->id;
+	}
+	/* Encode into worst case regions so images can be done in parallel, then
+	close the gaps */
+	for(i=0;i<cnt;++i) {
+		items[i].offset = base;
+		base += qoip_batch_region(&items[i].desc);
+	}
+	#pragma omp parallel num_threads(threads) reduction(|:err)
+	{
+		qoip_encoder_t te = e;/* Entropy contexts and scratch are per thread */
+		const int ok = !qoip_encoder_alloc_entropy(&te);
+		err |= !ok;
+		#pragma omp for schedule(dynamic)
+		for(i=0;i<cnt;++i) {
+			if(ok && qoip_encoder_encode(&te, items[i].data, &items[i].desc, bytes + items[i].offset, &items[i].len))
+				err = 1;
 		}
-		else if(desc->entropy==QOIP_ENTROPY_ZSTD) {
-			if(ZSTD_isError(ZSTD_decompress(scratch, desc->raw_cnt, q->in + q->p, desc->entropy_cnt)))
-				return qoip_ret(22, stderr, "qoip_decode: ZSTD decode failed");
+		qoip_encoder_release(&te);
+	}
+	if(err)
+		return qoip_ret(65, stderr, "qoip_encode_batch: Failed to encode an image");
+	for(i=0;i<cnt;++i) {
+		if(off != items[i].offset)
+			memmove(bytes + off, bytes + items[i].offset, items[i].len);
+		items[i].offset = off;
+		off += items[i].len;
+	}
+	*out_len = off;
+	return 0;
+}
+
+struct qoip_stream_enc {
+	qoip_working_t q;
+	qoip_tables_t tables;
+	qoip_opcode_t op[OP_END];
+	int op_cnt, fast;
+	qoip_desc desc;
+	size_t rows, row_max, cap;
+	qoip_write_fn write;
+	void *user;
+	unsigned char *rowbuf;/* Last row pushed, then room for the next one */
+	unsigned char buf[];/* Output pending a write, cap bytes, then rowbuf */
+};
+
+/* Hand the buffered output to the write callback. Up to 7 bytes are held back
+so q.p keeps the alignment qoip_finish pads to */
+static int qoip_stream_enc_flush(qoip_stream_enc_t *s, const int last) {
+	const size_t len = last ? s->q.p : s->q.p & ~(size_t)7;
+	if(len && s->write(s->user, s->buf, len))
+		return 1;
+	memmove(s->buf, s->buf + len, s->q.p - len);
+	s->q.p -= len;
+	return 0;
+}
+
+int qoip_stream_enc_begin(qoip_stream_enc_t **s, const qoip_desc *desc, const char *opstring, qoip_write_fn write, void *user) {
+	qoip_stream_enc_t *e;
+	qoip_working_t *restrict q;
+	size_t loc_bithead, row_max, cap;
+
+	if (
+		s == NULL || desc == NULL || write == NULL ||
+		desc->width == 0 || desc->height == 0 || desc->strip_height ||
+		desc->channels < 3 || desc->channels > 4 || desc->colorspace > 1
+	)
+		return qoip_ret(28, stderr, "qoip_stream_enc_begin: Bad arguments");
+	/* Worst case for a row is every pixel as RGBA plus the op ending a run.
+	Runs are written out in whole RUN2 ops as rows complete, so at most a row's
+	worth of output is produced between flushes */
+	row_max = (size_t)desc->width * (desc->channels + 1) + 2;
+	cap = row_max + QOIP_FILE_HEADER_SIZE + QOIP_BITSTREAM_HEADER_MAXSIZE + 16/*footer*/;
+	if(cap < 65536)/* Batch small rows into fewer writes */
+		cap = 65536;
+	if( !(e = malloc(sizeof(qoip_stream_enc_t) + cap + 2 * (size_t)desc->width * desc->channels)) )
+		return qoip_ret(29, stderr, "qoip_stream_enc_begin: Failed to allocate context");
+	memset(&e->q, 0, sizeof(qoip_working_t));
+	q = &e->q;
+	q->out = e->buf;
+	e->desc = *desc;
+	e->desc.entropy = QOIP_ENTROPY_NONE;
+	e->rows = 0;
+	e->row_max = row_max;
+	e->cap = cap;
+	e->rowbuf = e->buf + cap;
+	e->write = write;
+	e->user = user;
+
+	if(opstring == NULL || *opstring==0)
+		opstring = "02244082a0a6c4c5e2";
+	if(parse_opstring(opstring, e->op, &e->op_cnt) || qoip_expand_opcodes(&e->op_cnt, e->op, q)) {
+		free(e);
+		return qoip_ret(30, stderr, "qoip_stream_enc_begin: Failed to parse opstring");
+	}
+	/* Size stays 0 in the file header, meaning unknown (streamed). Ops stay in
+	id order as there are no frequencies to sort them by yet */
+	qoip_write_file_header(q->out, &q->p, &e->desc);
+	loc_bithead = q->p;
+	qoip_write_bitstream_header(q->out, &q->p, &e->desc, e->op, e->op_cnt);
+	if ((e->fast=qoip_fastpath_find(q->out+loc_bithead+9))==-1 || !qoip_fastpath[e->fast].enc) {
+		e->fast = -1;
+		qoip_sort_set(e->op, e->op_cnt);
+	}
+	qoip_init_tables(q, &e->tables, e->op, e->op_cnt, 1);
+	if(qoip_stream_enc_flush(e, 0)) {
+		free(e);
+		return qoip_ret(31, stderr, "qoip_stream_enc_begin: Write failed");
+	}
+	*s = e;
+	return 0;
+}
+
+int qoip_stream_enc_push_rows(qoip_stream_enc_t *s, const void *rows, size_t row_cnt) {
+	qoip_working_t *restrict q;
+	size_t i;
+	if(s == NULL || rows == NULL || row_cnt > s->desc.height - s->rows)
+		return qoip_ret(32, stderr, "qoip_stream_enc_push_rows: Bad arguments");
+	q = &s->q;
+	for(i=0;i<row_cnt;++i) {
+		const unsigned char *row = (const unsigned char *)rows + i * s->desc.width * s->desc.channels;
+		if(s->rows==0) {
+			qoip_init_working_memory(q, row, &s->desc);/* Set up the rest of the state from the first row */
+			q->in = row;
+			q->px_pos = 0;
 		}
-		else if(desc->entropy==QOIP_ENTROPY_ZSTD_DICTIONARY) {
-			ZSTD_DCtx* const dctx = ZSTD_createDCtx();
-			if((ret=qoip_dic_load()))
-				return ret;
-			if(ZSTD_isError(ZSTD_decompress_usingDict(dctx, scratch, desc->raw_cnt, q->in + q->p, desc->entropy_cnt, qoip_dic, qoip_dic_cnt)))
-				return qoip_ret(23, stderr, "qoip_decode: ZSTD decode failed");
-			ZSTD_freeDCtx(dctx);
+		else {/* The row above is read at px_pos - stride, keep it in front of row */
+			if(i==0) {
+				memcpy(s->rowbuf + q->stride, row, q->stride);
+				q->in = s->rowbuf;
+			}
+			else
+				q->in = row - q->stride;
+			q->px_pos = q->stride;
 		}
-		else
-			return qoip_ret(24, stderr, "qoip_decode: Unknown entropy coding, update decoder?");
-		q->p = 0;
-		q->in = scratch;
+		q->height = 1;
+		qoip_encode_pixels(q, s->op, s->op_cnt, s->fast);
+		++s->rows;
+		/* Splitting the run here is identical to qoip_encode_run writing it
+		whole later, it always leads with the full RUN2 ops */
+		for(;q->run >= q->run2_len;q->run -= q->run2_len)
+			qoip_write_op(q, (u32)q->run2_opcode << 8 | 255, 2);
+		if(s->cap - q->p < s->row_max + 16 && qoip_stream_enc_flush(s, 0))
+			return qoip_ret(33, stderr, "qoip_stream_enc_push_rows: Write failed");
 	}
+	if(row_cnt)
+		memcpy(s->rowbuf, (const unsigned char *)rows + (row_cnt - 1) * q->stride, q->stride);
+	return 0;
+}
 
-	q->width = desc->width;
-	q->height = desc->height;
-	q->channels = channels==0 ? desc->channels : channels;
-	q->stride = desc->width * q->channels;
-	q->px.v = 0;
-	q->px.rgba.a = 255;
-	q->in_tot = desc->entropy?desc->raw_cnt:data_len;
-	q->px_pos = 0;
+int qoip_stream_enc_end(qoip_stream_enc_t *s) {
+	int ret = 0;
+	if(s == NULL)
+		return qoip_ret(34, stderr, "qoip_stream_enc_end: Bad arguments");
+	if(s->rows != s->desc.height)
+		ret = qoip_ret(35, stderr, "qoip_stream_enc_end: Image incomplete");
+	else {
+		qoip_encode_run(&s->q);
+		qoip_finish(&s->q);
+		if(qoip_stream_enc_flush(s, 1))
+			ret = qoip_ret(36, stderr, "qoip_stream_enc_end: Write failed");
+	}
+	free(s);
+	return ret;
+}
 
-	if ((fast=qoip_fastpath_find(q->in+25))!=-1 && qoip_fastpath[fast].dec)
-		return qoip_fastpath[fast].dec(q);
+/* Entry per possible first byte of an op. Implicit ops are decoded before the
+table is consulted so their dec is NULL, len is the full op length in bytes */
+typedef struct {
+	void (*dec)(qoip_working_t *restrict);
+	u8 len;
+} qoip_dispatch_t;
+
+/* Op length in bytes by set */
+static const u8 qoip_set_len[] = {1, 1, 2, 2, 3, 4};
 
-	/*Decode order for generic path*/
+/* Fill dispatch from expanded opcodes */
+static void qoip_build_dispatch(qoip_dispatch_t *dispatch, const qoip_opcode_t *op, const int op_cnt, const qoip_working_t *q) {
+	int i, j;
 	for(i=0;i<op_cnt;++i) {
-		if(op[i].order!=i) {
-			for(j=i+1;j<op_cnt;++j) {
-				if(op[j].order==i){
-					qoip_opcode_swap(op+i, op+j);
-					break;
-				}
-			}
-			if(j==op_cnt)
-				return qoip_ret(19, stderr, "qoip_decode: Failed to order opcodes");
+		for(j=op[i].opcode;j<op[i].opcode+op[i].opcnt;++j) {
+			dispatch[j].dec = op[i].dec;
+			dispatch[j].len = qoip_set_len[op[i].set];
 		}
 	}
+	dispatch[q->rgb_opcode].dec = NULL;
+	dispatch[q->rgb_opcode].len = 4;
+	dispatch[q->rgba_opcode].dec = NULL;
+	dispatch[q->rgba_opcode].len = 5;
+	dispatch[q->run2_opcode].dec = NULL;
+	dispatch[q->run2_opcode].len = 2;
+	for(j=q->run1_len?q->run1_opcode:256;j<256;++j) {
+		dispatch[j].dec = NULL;
+		dispatch[j].len = 1;
+	}
+}
+
+/* Decode a row pixel by pixel, stopping before any op that isn't wholly
+buffered. Once all ops are in, dispatch gives their length up front */
+#define QOIP_DECODE_ROW(inner)                      \
+	do {                                              \
+		for(;q->px_w<q->width;++q->px_w) {              \
+			if(!q->run && (q->p >= q->in_tot || q->p + dispatch[q->in[q->p]].len > q->in_tot)) \
+				return 0;                                   \
+			inner;                                        \
+			if(q->channels==4)                            \
+				*(qoip_rgba_t*)(q->out + q->px_pos) = q->px; \
+			else {                                        \
+				q->out[q->px_pos + 0] = q->px.rgba.r;       \
+				q->out[q->px_pos + 1] = q->px.rgba.g;       \
+				q->out[q->px_pos + 2] = q->px.rgba.b;       \
+			}                                             \
+			q->px_pos += q->channels;                     \
+		}                                               \
+	} while (0)
+
+/* Continue the current row with the input up to in_tot, 1 if it was completed.
+path is qoip_generic_path_index, for decoders that get their input in pieces */
+static int qoip_decode_row(qoip_working_t *restrict q, const qoip_dispatch_t *dispatch, const int path) {
+	if(path==0)
+		QOIP_DECODE_ROW(QOIP_DECODE_INNER(0, 0));
+	else if(path==1)
+		QOIP_DECODE_ROW(QOIP_DECODE_INNER(0, 1));
+	else if(path==3)
+		QOIP_DECODE_ROW(QOIP_DECODE_INNER(1, 0));
+	else if(path==4)
+		QOIP_DECODE_ROW(QOIP_DECODE_INNER(1, 1));
+	else if(path==2)
+		QOIP_DECODE_ROW(QOIP_DECODE_INNERF(0));
+	else if(path==5)
+		QOIP_DECODE_ROW(QOIP_DECODE_INNERF(1));
+	return 1;
+}
+
+static void qoip_decode_bitstream(qoip_working_t *restrict q, qoip_opcode_t *op, const int op_cnt, const qoip_dispatch_t *dispatch, const int fast) {
+	int generic_path_choice;
+	if (fast!=-1) {
+		qoip_fastpath[fast].dec(q);
+		return;
+	}
 
 	/* Determine correct generic path and take it */
 	generic_path_choice = qoip_generic_path_index(op, op_cnt);
@@ -1234,8 +2360,722 @@ int qoip_decode(const void *data, const size_t data_len, qoip_desc *desc, const
 		QOIP_DECODE_LOOP(QOIP_DECODE_INNERF(0));
 	else if(generic_path_choice==5)
 		QOIP_DECODE_LOOP(QOIP_DECODE_INNERF(1));
+}
+
+/* Read the strip offsets of a bitstream len bytes long into *offset, followed
+by len. *offset is to be freed if this returns 0 */
+static int qoip_read_strip_table(const unsigned char *table, const qoip_desc *desc, const size_t len, size_t **offset) {
+	const size_t strip_cnt = qoip_strip_cnt(desc);
+	size_t s, loc = 0, prev = 0, *o;
+	if( !(o = malloc((strip_cnt + 1) * sizeof(size_t))) )
+		return qoip_ret(25, stderr, "qoip_decode: Failed to allocate strip table");
+	if(qoip_read_32(table, &loc)!=strip_cnt) {
+		free(o);
+		return qoip_ret(26, stderr, "qoip_decode: Strip count does not match dimensions");
+	}
+	for(s=0;s<strip_cnt;++s) {
+		o[s] = qoip_read_64(table, &loc);
+		if(o[s] < prev || o[s] > len) {
+			free(o);
+			return qoip_ret(27, stderr, "qoip_decode: Invalid strip offset");
+		}
+		prev = o[s];
+	}
+	o[strip_cnt] = len;
+	*offset = o;
+	return 0;
+}
+
+/* Decode strips in parallel, offsets are relative to q->in + q->p. Each strip
+starts from freshly initialised state, q has the opcodes expanded but has not
+decoded anything. Like q, each strip stops short of its padding */
+static int qoip_decode_strips(qoip_working_t *restrict q, qoip_opcode_t *op, const int op_cnt, const qoip_dispatch_t *dispatch, const int fast, const qoip_desc *desc, const unsigned char *table) {
+	const size_t strip_cnt = qoip_strip_cnt(desc), base = q->p;
+	size_t s, *offset;
+	int ret;
+	if( (ret = qoip_read_strip_table(table, desc, q->in_tot + 8 - base, &offset)) )
+		return ret;
+
+	#pragma omp parallel for schedule(dynamic)
+	for(s=0;s<strip_cnt;++s) {
+		qoip_working_t sq = *q;
+		qoip_tables_t st;
+		qoip_init_tables(&sq, &st, op, op_cnt, 0);
+		sq.in = q->in + base + offset[s];
+		sq.in_tot = offset[s+1] - offset[s] < 8 ? 0 : offset[s+1] - offset[s] - 8;
+		sq.p = 0;
+		sq.out = q->out + s * desc->strip_height * q->stride;
+		sq.height = (s==strip_cnt-1) ? q->height - s * desc->strip_height : desc->strip_height;
+		qoip_decode_bitstream(&sq, op, op_cnt, dispatch, fast);
+	}
+	free(offset);
+	return 0;
+}
+
+/* Everything qoip_decode works out from the ops of a file, reused by
+qoip_decoder_t while files keep coming with the same ops */
+struct qoip_decoder {
+	qoip_working_t q;/* Zeroed state with the opcodes expanded */
+	qoip_opcode_t op[OP_END];
+	qoip_dispatch_t dispatch[256];
+	u8 key[OP_END+1];/* Op count then ids in id order, valid if cached */
+	int op_cnt, fast, cached, own_scratch;
+	ZSTD_DCtx *dctx;
+	ZSTD_DDict *ddict;/* Digested dict, added dictionaries are used if dict is NULL */
+	const void *dict;
+	size_t dict_cnt;
+	u32 dict_id;
+	void *scratch;
+	size_t scratch_cap;
+};
+
+static void qoip_decoder_init(qoip_decoder_t *restrict d) {
+	d->cached = 0;
+	d->own_scratch = 0;
+	d->dctx = NULL;
+	d->ddict = NULL;
+	d->dict = NULL;
+	d->dict_cnt = 0;
+	d->dict_id = 0;
+	d->scratch = NULL;
+	d->scratch_cap = 0;
+}
+
+/* Free what d has created, not d itself */
+static void qoip_decoder_release(qoip_decoder_t *restrict d) {
+	ZSTD_freeDCtx(d->dctx);
+	ZSTD_freeDDict(d->ddict);
+	free(d->scratch);
+}
+
+/* Chunked entropy-coded data decoded by any number of threads. Chunks are
+claimed in order, done[i] is set once chunk i is in out, to 2 if it failed */
+typedef struct {
+	const unsigned char *in;/* Chunk table */
+	unsigned char *out;
+	size_t *off;/* Offset of each chunk from in, then of the end */
+	unsigned char *done;
+	const qoip_desc *desc;
+	const ZSTD_DDict *ddict;/* QOIP_ENTROPY_ZSTD_DICTIONARY only */
+	u32 chunk_cnt, next;
+} qoip_chunks_t;
+
+/* Read the chunk table at in, len bytes available. Returns non-zero if it is
+bad, qoip_chunks_free either way */
+static int qoip_chunks_init(qoip_chunks_t *c, const unsigned char *in, const size_t len, const qoip_desc *desc, const ZSTD_DDict *ddict, void *out) {
+	size_t i, p = 0, size;
+	c->in = in;
+	c->out = (unsigned char *)out;
+	c->desc = desc;
+	c->ddict = ddict;
+	c->chunk_cnt = qoip_entropy_chunk_cnt(desc);
+	c->next = 0;
+	c->off = NULL;
+	c->done = NULL;
+	if(
+		(u64)c->chunk_cnt * desc->entropy_chunk < desc->raw_cnt ||
+		desc->entropy_cnt < 4 * (u64)c->chunk_cnt || desc->entropy_cnt > len ||
+		!(c->off = malloc((c->chunk_cnt + 1) * sizeof(size_t))) ||
+		!(c->done = calloc(c->chunk_cnt, 1))
+	)
+		return 1;
+	c->off[0] = (4 * (size_t)c->chunk_cnt + 7) & ~(size_t)7;
+	for(i=0;i<c->chunk_cnt;++i) {
+		size = qoip_read_32(in, &p);
+		if(c->off[i] > desc->entropy_cnt || size > desc->entropy_cnt - c->off[i])
+			return 1;
+		c->off[i+1] = c->off[i] + size;
+	}
+	return 0;
+}
+
+static void qoip_chunks_free(qoip_chunks_t *c) {
+	free(c->off);
+	free(c->done);
+}
+
+/* Bitstream bytes in chunk i */
+static inline size_t qoip_chunk_raw(const qoip_desc *desc, const u32 i) {
+	const size_t pos = (size_t)i * desc->entropy_chunk;
+	return desc->raw_cnt - pos < desc->entropy_chunk ? desc->raw_cnt - pos : desc->entropy_chunk;
+}
+
+/* Entropy decode chunk i to dst, creating *dctx if needed. Non-zero on failure */
+static int qoip_chunk_decode(const qoip_chunks_t *c, const u32 i, unsigned char *dst, ZSTD_DCtx **dctx) {
+	const size_t size = c->off[i+1] - c->off[i], raw = qoip_chunk_raw(c->desc, i);
+	size_t zret;
+	if(c->desc->entropy==QOIP_ENTROPY_LZ4)
+		return LZ4_decompress_safe((const char *)c->in + c->off[i], (char *)dst, size, raw)!=(int)raw;
+	if(!*dctx && !(*dctx = ZSTD_createDCtx()))
+		return 1;
+	if(c->ddict)
+		zret = ZSTD_decompress_usingDDict(*dctx, dst, raw, c->in + c->off[i], size, c->ddict);
+	else
+		zret = ZSTD_decompressDCtx(*dctx, dst, raw, c->in + c->off[i], size);
+	return ZSTD_isError(zret) || zret!=raw;
+}
+
+/* Wait for another thread, spinning briefly before giving up the core */
+static inline void qoip_wait(u32 *spins) {
+	if(++*spins < 64) {
+#if defined(__SSE2__)
+		_mm_pause();
+#endif
+	}
+	else {
+#if defined(__unix__) || defined(__APPLE__)
+		sched_yield();
+#endif
+		*spins = 0;
+	}
+}
+
+/* Claim and decode the next chunk, 0 once none are left */
+static int qoip_chunks_work(qoip_chunks_t *c, ZSTD_DCtx **dctx) {
+	u32 i;
+	unsigned char r;
+	#pragma omp atomic read
+	i = c->next;
+	if(i >= c->chunk_cnt)/* Checked first so waiting doesn't run next up */
+		return 0;
+	#pragma omp atomic capture
+	i = c->next++;
+	if(i >= c->chunk_cnt)
+		return 0;
+	r = qoip_chunk_decode(c, i, c->out + (size_t)i * c->desc->entropy_chunk, dctx) ? 2 : 1;
+	#pragma omp flush
+	#pragma omp atomic
+	c->done[i] |= r;
+	return 1;
+}
+
+/* Decode the pixels of q from the chunks in order as they are done, decoding
+chunks itself rather than waiting while any are unclaimed. Ops spanning chunks
+are fine as the chunks are decoded back to back. Input stops 8 bytes short of
+the next chunk, which may still be being written, so 8 byte loads stay in done
+chunks. Non-zero if a chunk failed or the bitstream ended early */
+static int qoip_chunks_consume(qoip_chunks_t *c, qoip_working_t *restrict q, const qoip_dispatch_t *dispatch, const int path, ZSTD_DCtx **dctx) {
+	u32 k = 0, y, spins = 0;
+	unsigned char r;
+	q->in_tot = 0;
+	for(y=0;y<q->height;++y) {
+		while(!qoip_decode_row(q, dispatch, path)) {
+			if(k==c->chunk_cnt)
+				return 1;
+			for(;;) {
+				#pragma omp atomic read
+				r = c->done[k];
+				if(r)
+					break;
+				if(!qoip_chunks_work(c, dctx))
+					qoip_wait(&spins);
+			}
+			#pragma omp flush
+			if(r==2)
+				return 1;
+			++k;
+			q->in_tot = (k==c->chunk_cnt ? c->desc->raw_cnt : (size_t)k * c->desc->entropy_chunk) - 8;
+		}
+		q->px_w = 0;
+	}
+	return 0;
+}
+
+/* Entropy decode the chunks of c on all threads, dctx is used by one of them.
+With q the pixels are decoded by that thread as the chunks come in, overlapping
+the two. Non-zero on failure */
+static int qoip_chunks_decode(qoip_chunks_t *c, ZSTD_DCtx **dctx, qoip_working_t *restrict q, const qoip_dispatch_t *dispatch, const int path) {
+	int err = 0;
+	u32 i;
+	#pragma omp parallel reduction(|:err)
+	{
+		ZSTD_DCtx *tctx = NULL, **ctx = &tctx;
+		#pragma omp single nowait
+		{
+			ctx = dctx;
+			if(q)
+				err |= qoip_chunks_consume(c, q, dispatch, path, ctx);
+		}
+		while(qoip_chunks_work(c, ctx))
+			;
+		ZSTD_freeDCtx(tctx);
+	}
+	for(i=0;i<c->chunk_cnt && !q;++i)
+		err |= c->done[i]!=1;
+	return err;
+}
+
+/* Bitstream bytes held at once when entropy decoding without scratch */
+#define QOIP_DECODE_WINDOW 65536
+
+/* Entropy-coded data decoded a window at a time into buf, which the opcode
+decoder reads from directly instead of the whole bitstream in scratch. ZSTD
+streams any amount at a time. LZ4 can only decode whole blocks, so it takes a
+chunk at a time, or the whole bitstream if the file isn't chunked */
+typedef struct {
+	qoip_chunks_t c;/* Chunk table if chunked, c.desc is always set */
+	ZSTD_DCtx *dctx;
+	ZSTD_inBuffer zin;
+	unsigned char *buf;
+	size_t cap, raw;/* raw is the bitstream position of buf[0] */
+	u32 k;/* Next LZ4 chunk */
+} qoip_window_t;
+
+/* Set up w over the len bytes of entropy-coded data at in. dctx is used for
+ZSTD, with ddict if not NULL. Non-zero on failure, qoip_window_free either way */
+static int qoip_window_init(qoip_window_t *w, const unsigned char *in, const size_t len, const qoip_desc *desc, ZSTD_DCtx *dctx, const ZSTD_DDict *ddict) {
+	size_t start = 0;
+	w->c.in = in;
+	w->c.desc = desc;
+	w->c.ddict = ddict;
+	w->c.off = NULL;
+	w->c.done = NULL;
+	w->dctx = dctx;
+	w->buf = NULL;
+	w->raw = 0;
+	w->k = 0;
+	if(desc->entropy_cnt > len)
+		return 1;
+	if(desc->entropy_chunk) {
+		if(qoip_chunks_init(&w->c, in, len, desc, ddict, NULL))
+			return 1;
+		start = w->c.off[0];
+	}
+	if(desc->entropy==QOIP_ENTROPY_LZ4)
+		w->cap = desc->entropy_chunk ? desc->entropy_chunk + 8 : desc->raw_cnt;
+	else {
+		/* Chunks are whole frames back to back, the stream decodes them in turn */
+		w->cap = QOIP_DECODE_WINDOW;
+		w->zin.src = in + start;
+		w->zin.size = desc->entropy_cnt - start;
+		w->zin.pos = 0;
+		if(
+			ZSTD_isError(ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only)) ||
+			ZSTD_isError(ZSTD_DCtx_refDDict(dctx, ddict))
+		)
+			return 1;
+	}
+	/* Padding as the bitstream would have in scratch */
+	return !(w->buf = malloc(w->cap + 16));
+}
+
+/* Drop the input q has consumed and decode more after what is left. Non-zero
+if there is no more or it failed */
+static int qoip_window_fill(qoip_window_t *w, qoip_working_t *restrict q) {
+	const qoip_desc *desc = w->c.desc;
+	const size_t left = q->in_tot - q->p;
+	size_t zret, in_pos;
+	ZSTD_outBuffer zout;
+	memmove(w->buf, w->buf + q->p, left);
+	w->raw += q->p;
+	q->p = 0;
+	q->in_tot = left;
+	if(desc->entropy==QOIP_ENTROPY_LZ4) {
+		if(!desc->entropy_chunk) {
+			if(w->k++ || LZ4_decompress_safe((const char *)w->c.in, (char *)w->buf, desc->entropy_cnt, desc->raw_cnt)!=(int)desc->raw_cnt)
+				return 1;
+			q->in_tot = desc->raw_cnt;
+			return 0;
+		}
+		if(w->k==w->c.chunk_cnt || qoip_chunk_decode(&w->c, w->k, w->buf + left, &w->dctx))
+			return 1;
+		q->in_tot += qoip_chunk_raw(desc, w->k++);
+		return 0;
+	}
+	zout.dst = w->buf;
+	zout.size = w->cap;
+	zout.pos = left;
+	do {
+		in_pos = w->zin.pos;
+		zret = ZSTD_decompressStream(w->dctx, &zout, &w->zin);
+		if(ZSTD_isError(zret))
+			return 1;
+	} while(zout.pos==left && w->zin.pos!=in_pos);
+	q->in_tot = zout.pos;
+	return zout.pos==left;
+}
+
+/* The dictionary is sticky in a ZSTD_DCtx, so it is dropped for later decodes */
+static void qoip_window_free(qoip_window_t *w) {
+	qoip_chunks_free(&w->c);
+	free(w->buf);
+	if(w->c.desc->entropy!=QOIP_ENTROPY_LZ4)
+		ZSTD_DCtx_reset(w->dctx, ZSTD_reset_session_and_parameters);
+}
+
+/* Decode the pixels of q through w, q has the opcodes expanded but has not
+decoded anything. Strips are decoded one after another from the offsets, NULL
+for a single bitstream. Non-zero if the bitstream is bad or ended early */
+static int qoip_decode_window(qoip_working_t *restrict q, const qoip_opcode_t *op, const int op_cnt, const qoip_dispatch_t *dispatch, const qoip_desc *desc, const size_t *offset, qoip_window_t *w) {
+	const qoip_working_t q0 = *q;
+	const u32 strip_cnt = offset ? qoip_strip_cnt(desc) : 1;
+	const int path = qoip_generic_path_index(op, op_cnt);
+	qoip_tables_t tables;
+	size_t start, in_tot;
+	u32 s, y;
+	q->in = w->buf;
+	q->in_tot = 0;
+	q->p = 0;
+	for(s=0;s<strip_cnt;++s) {
+		/* Skip to the start of the strip, past any padding of the one before */
+		start = offset ? offset[s] : 0;
+		while(w->raw + q->in_tot < start) {
+			q->p = q->in_tot;
+			if(qoip_window_fill(w, q))
+				return 1;
+		}
+		start -= w->raw;
+		in_tot = q->in_tot;
+		*q = q0;
+		q->in = w->buf;
+		q->in_tot = in_tot;
+		q->p = start;
+		if(offset) {
+			q->out = q0.out + (size_t)s * desc->strip_height * q0.stride;
+			q->height = (s==strip_cnt-1) ? q0.height - (size_t)s * desc->strip_height : desc->strip_height;
+		}
+		qoip_init_tables(q, &tables, op, op_cnt, 0);
+		for(y=0;y<q->height;++y) {
+			while(!qoip_decode_row(q, dispatch, path))
+				if(qoip_window_fill(w, q))
+					return 1;
+			q->px_w = 0;
+		}
+	}
+	return 0;
+}
+
+static int qoip_decode_ctx(qoip_decoder_t *restrict d, const void *data, const size_t data_len, qoip_desc *desc, const int channels, void *out, void *scratch) {
+	int i, op_cnt, ret, pipeline;
+	u8 key[OP_END+1];
+	size_t loc = 0, loc_table, zret;
+	qoip_working_t qq;
+	qoip_working_t *restrict q = &qq;
+	qoip_tables_t tables;
+	qoip_opcode_t op[OP_END];
+	const unsigned char *in = (const unsigned char *)data;
+	const ZSTD_DDict *ddict;
+	const qoip_dict_t *dict;
+	qoip_chunks_t c;
+	qoip_window_t w;
+	size_t *offset;
+	void *p;
+
+	if (
+		data == NULL || desc == NULL ||
+		(channels != 0 && channels != 3 && channels != 4) ||
+		data_len < QOIP_FILE_HEADER_SIZE
+	)
+		return qoip_ret(16, stderr, "qoip_decode: Bad arguments");
+
+	if(qoip_read_file_header(in, data_len, &loc, desc))
+		return qoip_ret(17, stderr, "qoip_decode: Failed to read file header");
+	loc_table = 20 + qoip_entropy_header_size(desc);/* Past strip_height */
+	if(qoip_read_bitstream_header(in, &loc, desc, op, &op_cnt) || qoip_strip_cnt_invalid(in, desc))
+		return qoip_ret(18, stderr, "qoip_decode: Failed to read bitstream header");
+	/*Id order for opcode expansion*/
+	qsort(op, op_cnt, sizeof(qoip_opcode_t), opcode_comp_id);
+	/* Fastpath key is the op count and ids in id order. Opcodes only depend on
+	the id order, so any header order can take a fastpath */
+	key[0] = op_cnt;
+	for(i=0;i<op_cnt;++i)
+		key[i+1] = op[i].id;
+	if(!d->cached || memcmp(key, d->key, op_cnt+1)) {
+		d->cached = 0;
+		memcpy(d->op, op, op_cnt * sizeof(qoip_opcode_t));
+		d->op_cnt = op_cnt;
+		memset(&d->q, 0, sizeof(qoip_working_t));
+		d->fast = qoip_fastpath_find(key);
+		if(qoip_expand_opcodes(&d->op_cnt, d->op, &d->q))
+			return qoip_ret(19, stderr, "qoip_decode: Failed to expand opstring");
+		if (d->fast!=-1 && !qoip_fastpath[d->fast].dec)
+			d->fast = -1;
+		/*Generic path dispatches on the first byte, header order doesn't matter.
+		Also built for fastpaths, windowed entropy decode goes row by row with it*/
+		qoip_build_dispatch(d->dispatch, d->op, d->op_cnt, &d->q);
+		memcpy(d->key, key, op_cnt+1);
+		d->cached = 1;
+	}
+	*q = d->q;
+	q->in = in;
+	q->out = (unsigned char *)out;
+	q->p = loc;
+	q->width = desc->width;
+	q->height = desc->height;
+	q->channels = channels==0 ? desc->channels : channels;
+	q->stride = desc->width * q->channels;
+	q->px.v = 0;
+	q->px.rgba.a = 255;
+	/* Ops end before the minimum 8 bytes of padding, stopping short of it keeps
+	the 8 byte loads of the generic and fast decoders inside the input */
+	q->in_tot = data_len - 8;
+	q->px_pos = 0;
+
+	if(desc->entropy) {
+		if(!scratch && d->own_scratch) {
+			if(desc->raw_cnt > d->scratch_cap) {
+				if( !(p = realloc(d->scratch, desc->raw_cnt)) )
+					return qoip_ret(58, stderr, "qoip_decode: Failed to allocate scratch");
+				d->scratch = p;
+				d->scratch_cap = desc->raw_cnt;
+			}
+			scratch = d->scratch;
+		}
+		if(desc->entropy > QOIP_ENTROPY_ZSTD_DICTIONARY)
+			return qoip_ret(24, stderr, "qoip_decode: Unknown entropy coding, update decoder?");
+		ddict = NULL;
+		if(desc->entropy >= QOIP_ENTROPY_ZSTD && !d->dctx && !(d->dctx = ZSTD_createDCtx()))
+			return qoip_ret(59, stderr, "qoip_decode: Failed to create ZSTD context");
+		if(desc->entropy==QOIP_ENTROPY_ZSTD_DICTIONARY) {
+			if(d->dict) {
+				if(desc->dict_id && desc->dict_id != d->dict_id)
+					return qoip_ret(67, stderr, "qoip_decode: File coded with a different dictionary");
+				if(!d->ddict && !(d->ddict = ZSTD_createDDict(d->dict, d->dict_cnt)))
+					return qoip_ret(60, stderr, "qoip_decode: Failed to load ZSTD dictionary");
+				ddict = d->ddict;
+			}
+			else if( (dict = qoip_dict_find(desc->dict_id)) )
+				ddict = dict->ddict;
+			else
+				return qoip_ret(66, stderr, "qoip_decode: Dictionary not found, add it with qoip_dict_add");
+		}
+		if(!scratch) {
+			/* Entropy decode a window at a time as the pixels need it */
+			offset = NULL;
+			ret = 0;
+			if(qoip_window_init(&w, q->in + q->p, data_len - q->p, desc, d->dctx, ddict))
+				ret = qoip_ret(20, stderr, "qoip_decode: Failed to start windowed entropy decode");
+			else if(desc->strip_height && (ret = qoip_read_strip_table(in + loc_table, desc, desc->raw_cnt, &offset)))
+				;
+			else if(qoip_decode_window(q, d->op, d->op_cnt, d->dispatch, desc, offset, &w))
+				ret = qoip_ret(80, stderr, "qoip_decode: Windowed entropy decode failed");
+			free(offset);
+			qoip_window_free(&w);
+			return ret;
+		}
+		if(desc->entropy_chunk) {
+			/* Chunks are decoded on all threads. A single bitstream without a
+			fastpath is decoded as they come in rather than after, unless there is
+			no one to share with. Fastpaths decode the whole image in one call, they
+			gain more over the row decoder than the overlap saves */
+			pipeline = 0;
+#ifdef _OPENMP
+			pipeline = !desc->strip_height && d->fast==-1 && omp_get_max_threads() > 1;
+#endif
+			if(!(ret = qoip_chunks_init(&c, q->in + q->p, data_len - q->p, desc, ddict, scratch))) {
+				q->in = scratch;
+				q->p = 0;
+				if(pipeline)
+					qoip_init_tables(q, &tables, d->op, d->op_cnt, 0);
+				ret = qoip_chunks_decode(&c, &d->dctx, pipeline ? q : NULL, d->dispatch, qoip_generic_path_index(d->op, d->op_cnt));
+			}
+			qoip_chunks_free(&c);
+			if(ret)
+				return qoip_ret(79, stderr, "qoip_decode: Entropy chunk decode failed");
+			if(pipeline)
+				return 0;
+		}
+		else if(desc->entropy==QOIP_ENTROPY_LZ4) {
+			if(LZ4_decompress_safe((char *)q->in + q->p, (char *)scratch, desc->entropy_cnt, desc->raw_cnt)!=desc->raw_cnt)
+				return qoip_ret(21, stderr, "qoip_decode: LZ4 decode failed");
+		}
+		else {
+			if(ddict)
+				zret = ZSTD_decompress_usingDDict(d->dctx, scratch, desc->raw_cnt, q->in + q->p, desc->entropy_cnt, ddict);
+			else
+				zret = ZSTD_decompressDCtx(d->dctx, scratch, desc->raw_cnt, q->in + q->p, desc->entropy_cnt);
+			if(ZSTD_isError(zret))
+				return qoip_ret(desc->entropy==QOIP_ENTROPY_ZSTD ? 22 : 23, stderr, "qoip_decode: ZSTD decode failed");
+		}
+		q->p = 0;
+		q->in = scratch;
+		q->in_tot = desc->raw_cnt - 8;
+	}
 
+	if(desc->strip_height)
+		return qoip_decode_strips(q, d->op, d->op_cnt, d->dispatch, d->fast, desc, in + loc_table);
+	qoip_init_tables(q, &tables, d->op, d->op_cnt, 0);
+	qoip_decode_bitstream(q, d->op, d->op_cnt, d->dispatch, d->fast);
 	return 0;
 }
 
+int qoip_decode(const void *data, const size_t data_len, qoip_desc *desc, const int channels, void *out, void *scratch) {
+	qoip_decoder_t d;
+	int ret;
+	qoip_decoder_init(&d);
+	ret = qoip_decode_ctx(&d, data, data_len, desc, channels, out, scratch);
+	qoip_decoder_release(&d);
+	return ret;
+}
+
+int qoip_decoder_create(qoip_decoder_t **d) {
+	if(d == NULL)
+		return qoip_ret(61, stderr, "qoip_decoder_create: Bad arguments");
+	if( !(*d = malloc(sizeof(qoip_decoder_t))) )
+		return qoip_ret(62, stderr, "qoip_decoder_create: Failed to allocate context");
+	qoip_decoder_init(*d);
+	(*d)->own_scratch = 1;
+	return 0;
+}
+
+int qoip_decoder_decode(qoip_decoder_t *d, const void *data, const size_t data_len, qoip_desc *desc, const int channels, void *out) {
+	if(d == NULL)
+		return qoip_ret(63, stderr, "qoip_decoder_decode: Bad arguments");
+	return qoip_decode_ctx(d, data, data_len, desc, channels, out, NULL);
+}
+
+void qoip_decoder_free(qoip_decoder_t *d) {
+	if(d == NULL)
+		return;
+	qoip_decoder_release(d);
+	free(d);
+}
+
+void qoip_decoder_set_dict(qoip_decoder_t *d, const void *dict, const size_t dict_cnt) {
+	ZSTD_freeDDict(d->ddict);
+	d->ddict = NULL;
+	d->dict = dict;
+	d->dict_cnt = dict_cnt;
+	d->dict_id = dict ? qoip_dict_id(dict, dict_cnt) : 0;
+}
+
+
+/* Input buffered by the streaming decoder, enough for the largest headers */
+#define QOIP_STREAM_DEC_BUF 65536
+
+struct qoip_stream_dec {
+	qoip_working_t q;
+	qoip_tables_t tables;
+	qoip_opcode_t op[OP_END];
+	qoip_dispatch_t dispatch[256];
+	int channels, path, header;
+	qoip_desc desc;
+	u32 rows;
+	qoip_row_fn row;
+	void *user;
+	unsigned char *out;/* Two rows, see qoip_stream_dec_pixels */
+	unsigned char in[QOIP_STREAM_DEC_BUF + 8];/* Slack for the 8 byte op loads */
+};
+
+int qoip_stream_dec_begin(qoip_stream_dec_t **s, const int channels, qoip_row_fn row, void *user) {
+	qoip_stream_dec_t *d;
+	if(s == NULL || row == NULL || (channels != 0 && channels != 3 && channels != 4))
+		return qoip_ret(37, stderr, "qoip_stream_dec_begin: Bad arguments");
+	if( !(d = malloc(sizeof(qoip_stream_dec_t))) )
+		return qoip_ret(38, stderr, "qoip_stream_dec_begin: Failed to allocate context");
+	memset(&d->q, 0, sizeof(qoip_working_t));
+	d->q.in = d->in;
+	d->channels = channels;
+	d->header = 0;
+	d->rows = 0;
+	d->row = row;
+	d->user = user;
+	d->out = NULL;
+	*s = d;
+	return 0;
+}
+
+/* Read the headers once they are buffered, 0 with s->header unset if more
+input is needed */
+static int qoip_stream_dec_header(qoip_stream_dec_t *s) {
+	qoip_working_t *restrict q = &s->q;
+	int op_cnt;
+	size_t loc;
+	if(q->in_tot < 16 + 10)/* File header without entropy or strips, bitstream header up to op count */
+		return 0;
+	if(q->in[6] || q->in[7])
+		return qoip_ret(39, stderr, "qoip_stream_dec_push: Entropy coding and strips can't be streamed");
+	if(q->in_tot < 16 + ((10 + q->in[16 + 9] + 7) & ~(size_t)7))
+		return 0;
+	loc = 0;
+	if(qoip_read_file_header(q->in, q->in_tot, &loc, &s->desc))
+		return qoip_ret(40, stderr, "qoip_stream_dec_push: Failed to read file header");
+	if(qoip_read_bitstream_header(q->in, &loc, &s->desc, s->op, &op_cnt))
+		return qoip_ret(41, stderr, "qoip_stream_dec_push: Failed to read bitstream header");
+	qsort(s->op, op_cnt, sizeof(qoip_opcode_t), opcode_comp_id);
+	if(qoip_expand_opcodes(&op_cnt, s->op, q))
+		return qoip_ret(42, stderr, "qoip_stream_dec_push: Failed to expand opstring");
+	qoip_init_tables(q, &s->tables, s->op, op_cnt, 0);
+	/* Always the generic path, fastpaths decode the whole image in one call */
+	memset(s->dispatch, 0, sizeof(s->dispatch));
+	qoip_build_dispatch(s->dispatch, s->op, op_cnt, q);
+	s->path = qoip_generic_path_index(s->op, op_cnt);
+	q->width = s->desc.width;
+	q->height = s->desc.height;
+	q->channels = s->channels==0 ? s->desc.channels : s->channels;
+	q->stride = s->desc.width * q->channels;
+	q->px.v = 0;
+	q->px.rgba.a = 255;
+	q->px_pos = 0;
+	q->px_w = 0;
+	q->p = loc;
+	if( !(s->out = malloc(2 * q->stride)) )
+		return qoip_ret(43, stderr, "qoip_stream_dec_push: Failed to allocate row buffer");
+	q->out = s->out;
+	s->header = 1;
+	return 0;
+}
+
+/* Continue the current row, 1 if it was completed. The first row is decoded to
+the first half of s->out and the rest to the second, with the row before moved
+to the first half, so the decode macros find the row above at px_pos - stride
+as they would in qoip_decode */
+static int qoip_stream_dec_pixels(qoip_stream_dec_t *s) {
+	return qoip_decode_row(&s->q, s->dispatch, s->path);
+}
+
+int qoip_stream_dec_push(qoip_stream_dec_t *s, const void *data, size_t len) {
+	qoip_working_t *restrict q;
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t n;
+	int ret;
+	if(s == NULL || (data == NULL && len))
+		return qoip_ret(44, stderr, "qoip_stream_dec_push: Bad arguments");
+	q = &s->q;
+	while(len && !(s->header && s->rows==s->desc.height)) {/* Trailing padding is dropped */
+		n = QOIP_STREAM_DEC_BUF - q->in_tot;
+		if(n > len)
+			n = len;
+		memcpy(s->in + q->in_tot, bytes, n);
+		q->in_tot += n;
+		bytes += n;
+		len -= n;
+		if(!s->header && (ret=qoip_stream_dec_header(s)))
+			return ret;
+		while(s->header && s->rows<s->desc.height && qoip_stream_dec_pixels(s)) {
+			if(s->row(s->user, s->out + (s->rows ? q->stride : 0), s->rows))
+				return qoip_ret(45, stderr, "qoip_stream_dec_push: Row callback failed");
+			if(s->rows)
+				memcpy(s->out, s->out + q->stride, q->stride);
+			++s->rows;
+			q->px_w = 0;
+			q->px_pos = q->stride;
+		}
+		if(s->header) {/* Keep only the unconsumed part of the current op */
+			memmove(s->in, s->in + q->p, q->in_tot - q->p);
+			q->in_tot -= q->p;
+			q->p = 0;
+		}
+	}
+	return 0;
+}
+
+int qoip_stream_dec_desc(const qoip_stream_dec_t *s, qoip_desc *desc) {
+	if(s == NULL || desc == NULL || !s->header)
+		return 1;
+	*desc = s->desc;
+	return 0;
+}
+
+int qoip_stream_dec_end(qoip_stream_dec_t *s) {
+	int ret = 0;
+	if(s == NULL)
+		return qoip_ret(46, stderr, "qoip_stream_dec_end: Bad arguments");
+	if(!s->header || s->rows != s->desc.height)
+		ret = qoip_ret(47, stderr, "qoip_stream_dec_end: Image incomplete");
+	free(s->out);
+	free(s);
+	return ret;
+}
+
 #endif /* QOIP_C */
@@ -0,0 +1,459 @@
+/* SPDX-License-Identifier: MIT */
+/* qoiparchive.h - Many QOIP images in one file with a sorted directory
+
+Copyright 2021 Matthew Ling
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files(the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and / or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions :
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+-- USAGE:
+Define `QOIPARCHIVE_C` in the C file that defines `QOIP_C` to create the
+implementation. It uses qoip.h internals, so qoiparchive.h has to come after
+qoip.h's implementation: either define both and include qoiparchive.h alone, or
+include qoip.h with `QOIP_C` first. Including qoiparchive.h before that fails.
+
+Writing:
+	qoip_archive_write_begin/add/end: Append already encoded QOIP files under a
+	name each, the directory is written by qoip_archive_write_end. An optional
+	ZSTD dictionary is stored once for the whole archive, images using
+	QOIP_ENTROPY_ZSTD_DICTIONARY should be encoded with it set through
+	qoip_encoder_set_dict
+
+Reading:
+	qoip_archive_open maps the file (reads it where mmap isn't available). Entries
+	are found by binary search on the name with qoip_archive_find, or by index.
+	qoip_archive_entry gives the bytes of entry n, a complete QOIP file that
+	qoip_decode takes as is. qoip_archive_decode decodes it with a decoder kept in
+	the archive that already has the archive dictionary set. Only the pages of the
+	entry being decoded are touched
+
+-- FORMAT:
+Integers are little endian like the rest of QOIP, every section starts 8 byte
+aligned.
+
+	archive_header {
+		u32 magic;      // 'qpak'
+		u32 version;    // 1
+		u64 reserved;   // 0
+	}
+	u8 dict[dict_cnt];  // ZSTD dictionary shared by all entries, may be empty
+	qoip_file entry[];  // QOIP files back to back
+	directory_entry {
+		u64 offset;     // Of the QOIP file from the start of the archive
+		u64 size;
+		u32 name_off;   // Into names
+		u32 name_len;
+	} directory[entry_cnt]; // Sorted by name, byte order
+	u8 names[names_cnt];
+	archive_footer {
+		u64 dict_off, dict_cnt;
+		u64 dir_off, entry_cnt;
+		u64 names_off, names_cnt;
+		u32 magic;      // 'qpak'
+		u32 version;    // 1
+	}
+*/
+
+#ifndef QOIPARCHIVE_H
+#define QOIPARCHIVE_H
+#include "qoip.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Archive being written, opaque */
+typedef struct qoip_archive_writer qoip_archive_writer_t;
+
+/* Create the archive at path, storing dict_cnt bytes of dict as its shared
+dictionary (dict may be NULL). Returns >0 on failure, otherwise *w is freed by
+qoip_archive_write_end */
+int qoip_archive_write_begin(qoip_archive_writer_t **w, const char *path, const void *dict, size_t dict_cnt);
+
+/* Append the QOIP file data of len bytes as name */
+int qoip_archive_write_add(qoip_archive_writer_t *w, const char *name, const void *data, size_t len);
+
+/* Write the directory, close the file and free w. Fails on duplicate names, w is
+freed regardless */
+int qoip_archive_write_end(qoip_archive_writer_t *w);
+
+/* Opened archive, opaque. Not thread safe for qoip_archive_decode */
+typedef struct qoip_archive qoip_archive_t;
+
+/* Open the archive at path. Returns >0 on failure, otherwise *a must be closed
+with qoip_archive_close */
+int qoip_archive_open(qoip_archive_t **a, const char *path);
+
+void qoip_archive_close(qoip_archive_t *a);
+
+/* Number of entries */
+size_t qoip_archive_cnt(const qoip_archive_t *a);
+
+/* Set *n to the index of name. Returns non-zero if there is no such entry */
+int qoip_archive_find(const qoip_archive_t *a, const char *name, size_t *n);
+
+/* Name of entry n, not nul terminated */
+const char *qoip_archive_name(const qoip_archive_t *a, size_t n, size_t *len);
+
+/* Point data at the QOIP file of entry n. Returns >0 if n is out of range */
+int qoip_archive_entry(const qoip_archive_t *a, size_t n, const void **data, size_t *len);
+
+/* The archive dictionary, for decoders of entries other than the archive's own.
+dict is NULL if there is none */
+void qoip_archive_dict(const qoip_archive_t *a, const void **dict, size_t *dict_cnt);
+
+/* qoip_decode of entry n */
+int qoip_archive_decode(qoip_archive_t *a, size_t n, qoip_desc *desc, int channels, void *out);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* QOIPARCHIVE_H */
+
+#ifdef QOIPARCHIVE_C
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define QOIPARCHIVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define QOIP_ARCHIVE_MAGIC (((u32)'k') << 24 | ((u32)'a') << 16 | ((u32)'p') <<  8 | ((u32)'q'))
+#define QOIP_ARCHIVE_VERSION 1
+#define QOIP_ARCHIVE_HEADER_SIZE 16
+#define QOIP_ARCHIVE_FOOTER_SIZE 56
+#define QOIP_ARCHIVE_DIR_SIZE 24
+
+typedef struct {
+	u64 offset, size;
+	char *name;
+} qoip_archive_added_t;
+
+struct qoip_archive_writer {
+	FILE *io;
+	u64 pos, dict_off, dict_cnt;
+	qoip_archive_added_t *entry;
+	size_t cnt, cap;
+};
+
+/* Write len bytes and zeroes up to the next multiple of 8 */
+static int qoip_archive_put(qoip_archive_writer_t *w, const void *data, size_t len) {
+	static const unsigned char zero[8] = {0};
+	const size_t pad = (8 - (len & 7)) & 7;
+	if(fwrite(data, 1, len, w->io)!=len || fwrite(zero, 1, pad, w->io)!=pad)
+		return 1;
+	w->pos += len + pad;
+	return 0;
+}
+
+int qoip_archive_write_begin(qoip_archive_writer_t **w, const char *path, const void *dict, size_t dict_cnt) {
+	qoip_archive_writer_t *n;
+	unsigned char header[QOIP_ARCHIVE_HEADER_SIZE] = {0};
+	size_t p = 0;
+	if(w == NULL || path == NULL || (dict == NULL && dict_cnt))
+		return qoip_ret(81, stderr, "qoip_archive_write_begin: Bad arguments");
+	if( !(n = malloc(sizeof(qoip_archive_writer_t))) )
+		return qoip_ret(82, stderr, "qoip_archive_write_begin: Failed to allocate writer");
+	if( !(n->io = fopen(path, "wb")) ) {
+		free(n);
+		return qoip_ret(83, stderr, "qoip_archive_write_begin: Failed to create file");
+	}
+	n->pos = 0;
+	n->entry = NULL;
+	n->cnt = n->cap = 0;
+	qoip_write_32(header, &p, QOIP_ARCHIVE_MAGIC);
+	qoip_write_32(header, &p, QOIP_ARCHIVE_VERSION);
+	n->dict_off = QOIP_ARCHIVE_HEADER_SIZE;
+	n->dict_cnt = dict_cnt;
+	if(qoip_archive_put(n, header, sizeof(header)) || (dict_cnt && qoip_archive_put(n, dict, dict_cnt))) {
+		fclose(n->io);
+		free(n);
+		return qoip_ret(84, stderr, "qoip_archive_write_begin: Write failed");
+	}
+	*w = n;
+	return 0;
+}
+
+int qoip_archive_write_add(qoip_archive_writer_t *w, const char *name, const void *data, size_t len) {
+	qoip_archive_added_t *e;
+	qoip_desc desc;
+	size_t name_len;
+	if(w == NULL || name == NULL || data == NULL || qoip_read_header(data, len, NULL, &desc))
+		return qoip_ret(85, stderr, "qoip_archive_write_add: Bad arguments");
+	if(w->cnt==w->cap) {
+		w->cap = w->cap ? w->cap * 2 : 64;
+		if( !(e = realloc(w->entry, w->cap * sizeof(qoip_archive_added_t))) )
+			return qoip_ret(86, stderr, "qoip_archive_write_add: Failed to allocate directory");
+		w->entry = e;
+	}
+	e = w->entry + w->cnt;
+	name_len = strlen(name);
+	if( !(e->name = malloc(name_len + 1)) )
+		return qoip_ret(87, stderr, "qoip_archive_write_add: Failed to allocate name");
+	memcpy(e->name, name, name_len + 1);
+	e->offset = w->pos;
+	e->size = len;
+	if(qoip_archive_put(w, data, len)) {
+		free(e->name);
+		return qoip_ret(88, stderr, "qoip_archive_write_add: Write failed");
+	}
+	++w->cnt;
+	return 0;
+}
+
+static int qoip_archive_added_comp(const void *a, const void *b) {
+	return strcmp(((const qoip_archive_added_t *)a)->name, ((const qoip_archive_added_t *)b)->name);
+}
+
+static int qoip_archive_write_dir(qoip_archive_writer_t *w) {
+	unsigned char rec[QOIP_ARCHIVE_FOOTER_SIZE];
+	u64 dir_off, names_off, names_cnt = 0;
+	size_t i, p, len;
+	qsort(w->entry, w->cnt, sizeof(qoip_archive_added_t), qoip_archive_added_comp);
+	for(i=1;i<w->cnt;++i) {
+		if(strcmp(w->entry[i-1].name, w->entry[i].name)==0)
+			return qoip_ret(89, stderr, "qoip_archive_write_end: Duplicate name");
+	}
+	dir_off = w->pos;
+	for(i=0;i<w->cnt;++i) {
+		len = strlen(w->entry[i].name);
+		qoip_write_64(rec, w->entry[i].offset);
+		qoip_write_64(rec + 8, w->entry[i].size);
+		p = 16;
+		qoip_write_32(rec, &p, names_cnt);
+		qoip_write_32(rec, &p, len);
+		if(fwrite(rec, 1, QOIP_ARCHIVE_DIR_SIZE, w->io)!=QOIP_ARCHIVE_DIR_SIZE)
+			return qoip_ret(90, stderr, "qoip_archive_write_end: Write failed");
+		names_cnt += len;
+	}
+	w->pos += w->cnt * QOIP_ARCHIVE_DIR_SIZE;
+	names_off = w->pos;
+	for(i=0;i<w->cnt;++i) {
+		len = strlen(w->entry[i].name);
+		if(fwrite(w->entry[i].name, 1, len, w->io)!=len)
+			return qoip_ret(91, stderr, "qoip_archive_write_end: Write failed");
+	}
+	w->pos += names_cnt;
+	memset(rec, 0, 8);
+	if(fwrite(rec, 1, (8 - (names_cnt & 7)) & 7, w->io)!=((8 - (names_cnt & 7)) & 7))
+		return qoip_ret(92, stderr, "qoip_archive_write_end: Write failed");
+	qoip_write_64(rec, w->dict_off);
+	qoip_write_64(rec + 8, w->dict_cnt);
+	qoip_write_64(rec + 16, dir_off);
+	qoip_write_64(rec + 24, w->cnt);
+	qoip_write_64(rec + 32, names_off);
+	qoip_write_64(rec + 40, names_cnt);
+	p = 48;
+	qoip_write_32(rec, &p, QOIP_ARCHIVE_MAGIC);
+	qoip_write_32(rec, &p, QOIP_ARCHIVE_VERSION);
+	if(fwrite(rec, 1, QOIP_ARCHIVE_FOOTER_SIZE, w->io)!=QOIP_ARCHIVE_FOOTER_SIZE)
+		return qoip_ret(93, stderr, "qoip_archive_write_end: Write failed");
+	return 0;
+}
+
+int qoip_archive_write_end(qoip_archive_writer_t *w) {
+	int ret;
+	size_t i;
+	if(w == NULL)
+		return qoip_ret(94, stderr, "qoip_archive_write_end: Bad arguments");
+	ret = qoip_archive_write_dir(w);
+	if(fclose(w->io) && !ret)
+		ret = qoip_ret(95, stderr, "qoip_archive_write_end: Write failed");
+	for(i=0;i<w->cnt;++i)
+		free(w->entry[i].name);
+	free(w->entry);
+	free(w);
+	return ret;
+}
+
+struct qoip_archive {
+	const unsigned char *data;
+	size_t size;
+	int mapped;
+	const unsigned char *dict, *dir, *names;
+	u64 dict_cnt, entry_cnt, names_cnt;
+	qoip_decoder_t *dec;/* Created on the first qoip_archive_decode */
+};
+
+/* Check the footer and point a at the sections it describes */
+static int qoip_archive_index(qoip_archive_t *a) {
+	size_t p = a->size - QOIP_ARCHIVE_FOOTER_SIZE;
+	u64 dict_off, dir_off, names_off;
+	if(a->size < QOIP_ARCHIVE_HEADER_SIZE + QOIP_ARCHIVE_FOOTER_SIZE)
+		return 1;
+	dict_off    = qoip_read_64(a->data, &p);
+	a->dict_cnt = qoip_read_64(a->data, &p);
+	dir_off     = qoip_read_64(a->data, &p);
+	a->entry_cnt= qoip_read_64(a->data, &p);
+	names_off   = qoip_read_64(a->data, &p);
+	a->names_cnt= qoip_read_64(a->data, &p);
+	if(qoip_read_32(a->data, &p)!=QOIP_ARCHIVE_MAGIC || qoip_read_32(a->data, &p)!=QOIP_ARCHIVE_VERSION)
+		return 1;
+	p = a->size - QOIP_ARCHIVE_FOOTER_SIZE;
+	if(
+		dict_off > p || a->dict_cnt > p - dict_off ||
+		dir_off > p || a->entry_cnt > (p - dir_off) / QOIP_ARCHIVE_DIR_SIZE ||
+		names_off > p || a->names_cnt > p - names_off
+	)
+		return 1;
+	a->dict = a->dict_cnt ? a->data + dict_off : NULL;
+	a->dir = a->data + dir_off;
+	a->names = a->data + names_off;
+	return 0;
+}
+
+int qoip_archive_open(qoip_archive_t **a, const char *path) {
+	qoip_archive_t *n;
+	FILE *f;
+	void *buf;
+	if(a == NULL || path == NULL)
+		return qoip_ret(96, stderr, "qoip_archive_open: Bad arguments");
+	if( !(n = malloc(sizeof(qoip_archive_t))) )
+		return qoip_ret(97, stderr, "qoip_archive_open: Failed to allocate archive");
+	n->data = NULL;
+	n->mapped = 0;
+	n->dec = NULL;
+#ifdef QOIPARCHIVE_MMAP
+	{
+		int fd;
+		struct stat st;
+		if ( (fd = open(path, O_RDONLY)) != -1 ) {
+			if ( !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+					(buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED ) {
+				madvise(buf, st.st_size, MADV_RANDOM);/* Entries are read one at a time */
+				n->data = buf;
+				n->size = st.st_size;
+				n->mapped = 1;
+			}
+			close(fd);
+		}
+	}
+#endif
+	if(!n->mapped) {
+		if( !(f = fopen(path, "rb")) ) {
+			free(n);
+			return qoip_ret(98, stderr, "qoip_archive_open: Failed to open file");
+		}
+		fseek(f, 0, SEEK_END);
+		n->size = ftell(f);
+		rewind(f);
+		if( !(buf = malloc(n->size ? n->size : 1)) || fread(buf, 1, n->size, f)!=n->size ) {
+			free(buf);
+			fclose(f);
+			free(n);
+			return qoip_ret(99, stderr, "qoip_archive_open: Failed to read file");
+		}
+		fclose(f);
+		n->data = buf;
+	}
+	if(qoip_archive_index(n)) {
+		qoip_archive_close(n);
+		return qoip_ret(100, stderr, "qoip_archive_open: Not a valid archive");
+	}
+	*a = n;
+	return 0;
+}
+
+void qoip_archive_close(qoip_archive_t *a) {
+	if(a == NULL)
+		return;
+	qoip_decoder_free(a->dec);
+#ifdef QOIPARCHIVE_MMAP
+	if(a->mapped)
+		munmap((void *)a->data, a->size);
+	else
+#endif
+	free((void *)a->data);
+	free(a);
+}
+
+size_t qoip_archive_cnt(const qoip_archive_t *a) {
+	return a->entry_cnt;
+}
+
+const char *qoip_archive_name(const qoip_archive_t *a, size_t n, size_t *len) {
+	size_t p = n * QOIP_ARCHIVE_DIR_SIZE + 16;
+	const u32 off = qoip_read_32(a->dir, &p);
+	*len = qoip_read_32(a->dir, &p);
+	if(off > a->names_cnt || *len > a->names_cnt - off) {
+		*len = 0;
+		return "";
+	}
+	return (const char *)a->names + off;
+}
+
+int qoip_archive_find(const qoip_archive_t *a, const char *name, size_t *n) {
+	size_t lo = 0, hi = a->entry_cnt, mid, len, name_len = strlen(name);
+	const char *s;
+	int c;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		s = qoip_archive_name(a, mid, &len);
+		c = memcmp(s, name, len < name_len ? len : name_len);
+		if(c==0)
+			c = (len > name_len) - (len < name_len);
+		if(c==0) {
+			*n = mid;
+			return 0;
+		}
+		if(c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 1;
+}
+
+int qoip_archive_entry(const qoip_archive_t *a, size_t n, const void **data, size_t *len) {
+	size_t p = n * QOIP_ARCHIVE_DIR_SIZE;
+	u64 off, size;
+	if(n >= a->entry_cnt)
+		return qoip_ret(101, stderr, "qoip_archive_entry: No such entry");
+	off = qoip_read_64(a->dir, &p);
+	size = qoip_read_64(a->dir, &p);
+	if(off > a->size || size > a->size - off)
+		return qoip_ret(102, stderr, "qoip_archive_entry: Entry outside the archive");
+	*data = a->data + off;
+	*len = size;
+	return 0;
+}
+
+void qoip_archive_dict(const qoip_archive_t *a, const void **dict, size_t *dict_cnt) {
+	*dict = a->dict;
+	*dict_cnt = a->dict_cnt;
+}
+
+int qoip_archive_decode(qoip_archive_t *a, size_t n, qoip_desc *desc, int channels, void *out) {
+	const void *data;
+	size_t len;
+	int ret;
+	if((ret=qoip_archive_entry(a, n, &data, &len)))
+		return ret;
+	if(!a->dec) {
+		if((ret=qoip_decoder_create(&a->dec)))
+			return ret;
+		if(a->dict)
+			qoip_decoder_set_dict(a->dec, a->dict, a->dict_cnt);
+	}
+	return qoip_decoder_decode(a->dec, data, len, desc, channels, out);
+}
+
+#endif /* QOIPARCHIVE_C */
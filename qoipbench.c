@@ -102,6 +102,40 @@ static uint64_t ns() {
 #endif
 }
 
+// -----------------------------------------------------------------------------
+// Branch miss counter for this thread, from Linux perf events
+
+#if defined(__linux)
+	#define HAVE_PERF_COUNTER
+	#include <linux/perf_event.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+static uint64_t branch_misses() {
+	uint64_t count = 0;
+#if defined(HAVE_PERF_COUNTER)
+	static int fd = -2;
+	if (fd == -2) {
+		struct perf_event_attr pe;
+		memset(&pe, 0, sizeof(pe));
+		pe.type = PERF_TYPE_HARDWARE;
+		pe.size = sizeof(pe);
+		pe.config = PERF_COUNT_HW_BRANCH_MISSES;
+		pe.exclude_kernel = 1;
+		pe.exclude_hv = 1;
+		fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+		if (fd == -1) {
+			printf("Branch miss counter unavailable, counts will be 0\n");
+		}
+	}
+	if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count)) {
+		count = 0;
+	}
+#endif
+	return count;
+}
+
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 #define ERROR(...) printf("abort at line " TOSTRING(__LINE__) ": " __VA_ARGS__); printf("\n"); exit(1)
@@ -307,6 +341,7 @@ typedef struct {
 	uint64_t size;
 	uint64_t encode_time;
 	uint64_t decode_time;
+	uint64_t decode_misses;
 } benchmark_lib_result_t;
 
 typedef struct {
@@ -331,6 +366,7 @@ void benchmark_print_result(opt_t *opt, char *effort, benchmark_result_t res) {
 	res.stbi.size /= res.count;
 	res.qoip.encode_time /= res.count;
 	res.qoip.decode_time /= res.count;
+	res.qoip.decode_misses /= res.count;
 	res.qoip.size /= res.count;
 
 	double px = res.px;
@@ -365,6 +401,13 @@ void benchmark_print_result(opt_t *opt, char *effort, benchmark_result_t res) {
 		((double)res.qoip.size/(double)res.raw_size) * 100.0,
 		effort, opt->threads, opt->entropy
 	);
+	if (opt->branches) {
+		printf(
+			"decode branch misses: %"PRIu64" (%.4f per pixel): qoip\n",
+			res.qoip.decode_misses,
+			px > 0 ? (double)res.qoip.decode_misses / px : 0
+		);
+	}
 	printf("\n");
 	fflush(stdout);
 }
@@ -402,6 +445,10 @@ benchmark_result_t benchmark_image(opt_t *opt, char *effort, const char *path) {
 	desc_raw.height = h;
 	desc_raw.channels = channels;
 	desc_raw.colorspace = QOIP_SRGB;
+	desc_raw.strip_height = opt->strip;
+	desc_raw.entropy_level = opt->level;
+	desc_raw.entropy_threads = opt->threads;
+	desc_raw.entropy_chunk = opt->chunk;
 	qoip_max_size = qoip_maxsize(&desc_raw);
 	qoip_max_size = qoip_max_size < qoip_maxentropysize(qoip_max_size, opt->entropy) ? qoip_maxentropysize(qoip_max_size, opt->entropy) : qoip_max_size;
 	encoded_qoip = malloc(qoip_max_size);
@@ -417,7 +464,7 @@ benchmark_result_t benchmark_image(opt_t *opt, char *effort, const char *path) {
 	}
 
 	// Read header to populate qoi_desc from encoded file and malloc dest
-	if (qoip_read_header(encoded_qoip, NULL, &desc_enc)) {
+	if (qoip_read_header(encoded_qoip, qoip_encoded_size, NULL, &desc_enc)) {
 		ERROR("Error, header read failed %s", path);
 	}
 	// Set channels to 4 to reuse pixels_qoip as benchmark decode sink
@@ -459,12 +506,17 @@ benchmark_result_t benchmark_image(opt_t *opt, char *effort, const char *path) {
 			});
 		}
 
+		uint64_t misses = opt->branches ? branch_misses() : 0;
 		BENCHMARK_FN(opt->warmup?0:1, opt->iterations, res.qoip.decode_time, {
 			qoip_desc desc;
 			if(qoip_decode(encoded_qoip, qoip_encoded_size, &desc, 4, pixels_qoip, scratch)) {
 				ERROR("Error, qoip_decode failed %s", path);
 			}
 		});
+		// Average over every run, including the warmup
+		if (opt->branches && opt->iterations) {
+			res.qoip.decode_misses = (branch_misses() - misses) / (opt->iterations + (opt->warmup?1:0));
+		}
 	}
 
 	free(pixels_qoip);
@@ -562,6 +614,7 @@ void benchmark_directory(opt_t *opt, char *effort, const char *path, benchmark_r
 		dir_total.stbi.size += res.stbi.size;
 		dir_total.qoip.encode_time += res.qoip.encode_time;
 		dir_total.qoip.decode_time += res.qoip.decode_time;
+		dir_total.qoip.decode_misses += res.qoip.decode_misses;
 		dir_total.qoip.size += res.qoip.size;
 
 		grand_total->count++;
@@ -575,6 +628,7 @@ void benchmark_directory(opt_t *opt, char *effort, const char *path, benchmark_r
 		grand_total->stbi.size += res.stbi.size;
 		grand_total->qoip.encode_time += res.qoip.encode_time;
 		grand_total->qoip.decode_time += res.qoip.decode_time;
+		grand_total->qoip.decode_misses += res.qoip.decode_misses;
 		grand_total->qoip.size += res.qoip.size;
 	}
 	closedir(dir);
@@ -43,8 +43,20 @@ SOFTWARE.
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
+/* Files are mapped rather than copied through a buffer where possible, with the
+stdio path as fallback */
+#if defined(__unix__) || defined(__APPLE__)
+#define QOIPCONV_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /* Encode raw RGB or RGBA pixels into a QOIP image and write it to the file
 system. The qoip_desc struct must be filled with the image width, height,
 number of channels (3 = RGB, 4 = RGBA) and the colorspace.
@@ -69,6 +81,60 @@ void *qoip_read(const char *filename, qoip_desc *desc, int channels);
 	#define QOIP_FREE(p)    free(p)
 #endif
 
+#ifdef QOIPCONV_MMAP
+#define QOIPCONV_ENCODE_FAILED ((size_t)-1)
+
+/* Encode straight into a temporary file next to the output, sized for the worst
+case then truncated to the encoded size, and rename it over the output once
+complete. Returns 0 if it can't be mapped so the caller falls back to stdio,
+QOIPCONV_ENCODE_FAILED if encoding failed. The output is untouched either way */
+static size_t qoipcrunch_write_mmap(const char *filename, const void *data, const qoip_desc *desc, char *effort, int threads, int entropy, size_t max_size, void *scratch) {
+	int fd, encode_ret;
+	size_t size = 0;
+	void *encoded;
+	char *tmpname;
+	struct stat st;
+	mode_t mode;
+
+	/* Replacing a link or device would not write through it like fopen does */
+	if ( !lstat(filename, &st) ) {
+		if ( !S_ISREG(st.st_mode) )
+			return 0;
+		mode = st.st_mode & 07777;
+	}
+	else {
+		mode = umask(0);
+		umask(mode);
+		mode = 0666 & ~mode;
+	}
+	if ( !(tmpname = QOIP_MALLOC(strlen(filename) + 8)) )
+		return 0;
+	sprintf(tmpname, "%s.XXXXXX", filename);
+	if ( (fd = mkstemp(tmpname)) == -1 ) {
+		QOIP_FREE(tmpname);
+		return 0;
+	}
+	if ( fchmod(fd, mode) || ftruncate(fd, max_size) ||
+			(encoded = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+		close(fd);
+		unlink(tmpname);
+		QOIP_FREE(tmpname);
+		return 0;
+	}
+	encode_ret = qoipcrunch_encode(data, desc, encoded, &size, effort, scratch, threads, entropy);
+	munmap(encoded, max_size);
+	if ( encode_ret )
+		size = QOIPCONV_ENCODE_FAILED;
+	else if ( ftruncate(fd, size) || rename(tmpname, filename) )
+		size = 0;
+	close(fd);
+	if ( encode_ret || !size )
+		unlink(tmpname);
+	QOIP_FREE(tmpname);
+	return size;
+}
+#endif
+
 size_t qoipcrunch_write(const char *filename, const void *data, const qoip_desc *desc, char *effort, int threads, int entropy) {
 	FILE *f;
 	size_t max_size, size;
@@ -77,8 +143,14 @@ size_t qoipcrunch_write(const char *filename, const void *data, const qoip_desc
 
 	max_size = qoip_maxsize(desc);
 	max_size = max_size < qoip_maxentropysize(max_size, entropy) ? qoip_maxentropysize(max_size, entropy) : max_size;
-	encoded = QOIP_MALLOC(max_size);
 	scratch = QOIP_MALLOC(max_size*threads);
+#ifdef QOIPCONV_MMAP
+	if ( scratch && (size = qoipcrunch_write_mmap(filename, data, desc, effort, threads, entropy, max_size, scratch)) ) {
+		QOIP_FREE(scratch);
+		return size == QOIPCONV_ENCODE_FAILED ? 0 : size;
+	}
+#endif
+	encoded = QOIP_MALLOC(max_size);
 
 	encode_ret = qoipcrunch_encode(data, desc, encoded, &size, effort, scratch, threads, entropy);
 
@@ -97,46 +169,87 @@ size_t qoipcrunch_write(const char *filename, const void *data, const qoip_desc
 }
 
 void *qoip_read(const char *filename, qoip_desc *desc, int channels) {
-	FILE *f = fopen(filename, "rb");
+	FILE *f = NULL;
 	size_t max_size, size;
-	void *pixels = NULL, *data = NULL, *scratch = NULL;
+	void *pixels = NULL, *data = NULL;
+	int mapped = 0;
+
+#ifdef QOIPCONV_MMAP
+	/* Decode from the page cache instead of a copy of the file */
+	int fd;
+	struct stat st;
+	if ( (fd = open(filename, O_RDONLY)) != -1 ) {
+		if ( !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+				(data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED ) {
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			size = st.st_size;
+			mapped = 1;
+		}
+		else
+			data = NULL;
+		close(fd);
+	}
+#endif
+	if (!mapped) {
+		if ( !(f = fopen(filename, "rb")) )
+			goto cleanup;
 
-	if (!f)
-		goto cleanup;
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		if (size == 0)
+			goto cleanup;
+		rewind(f);
+		if ( !(data = QOIP_MALLOC(size)) )
+			goto cleanup;
 
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	if (size == 0)
-		goto cleanup;
-	rewind(f);
-	if ( !(data = QOIP_MALLOC(size)) )
-		goto cleanup;
+		if ( fread(data, 1, size, f)!=size )
+			goto cleanup;
+	}
 
-	if ( fread(data, 1, size, f)!=size )
+	if ( qoip_read_header(data, size, NULL, desc) )
 		goto cleanup;
-
-	qoip_read_header(data, NULL, desc);
 	max_size = qoip_maxsize_raw(desc, channels);
-	if ( desc->entropy && !(scratch = QOIP_MALLOC(desc->raw_cnt)) )
-			goto cleanup;
 	if ( !(pixels = QOIP_MALLOC(max_size)) )
 		goto cleanup;
 
-	if ( qoip_decode(data, size, desc, channels, pixels, scratch) ) {
+	if ( qoip_decode(data, size, desc, channels, pixels, NULL) ) {
 		free(pixels);
 		pixels = NULL;
 	}
 
 	cleanup:
+#ifdef QOIPCONV_MMAP
+	if(mapped)
+		munmap(data, size);
+	else
+#endif
 	if(data)
 		QOIP_FREE(data);
 	if(f)
 		fclose(f);
-	if(scratch)
-		free(scratch);
 	return pixels;
 }
 
+/* Add the dictionary file at path for QOIP_ENTROPY_ZSTD_DICTIONARY. Returns
+non-zero on failure */
+static int qoipconv_add_dict(const char *path) {
+	FILE *f;
+	void *dict = NULL;
+	size_t size;
+	int ret = 1;
+	if ( !(f = fopen(path, "rb")) )
+		return 1;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	if ( size && (dict = QOIP_MALLOC(size)) && fread(dict, 1, size, f)==size )
+		ret = qoip_dict_add(dict, size, NULL);
+	if(dict)
+		QOIP_FREE(dict);
+	fclose(f);
+	return ret;
+}
+
 #define STR_ENDS_WITH(S, E) (strcmp(S + strlen(S) - (sizeof(E)-1), E) == 0)
 
 int optmode_license(opt_t *opt) {
@@ -180,6 +293,10 @@ int main(int argc, char **argv) {
 		printf("Input and output files need to be defined\n");
 		return 1;
 	}
+	if(opt.dictionary && qoipconv_add_dict(opt.dictionary)) {
+		printf("Couldn't load dictionary %s\n", opt.dictionary);
+		return 1;
+	}
 
 	void *pixels = NULL;
 	int w, h, channels;
@@ -218,7 +335,11 @@ int main(int argc, char **argv) {
 			.width = w,
 			.height = h,
 			.channels = channels,
-			.colorspace = QOIP_SRGB
+			.colorspace = QOIP_SRGB,
+			.strip_height = opt.strip,
+			.entropy_level = opt.level,
+			.entropy_threads = opt.threads,
+			.entropy_chunk = opt.chunk
 		}, (opt.custom?opt.custom:effort_level), opt.threads, opt.entropy);
 	}
 
@@ -84,7 +84,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	/* Decode qoip to raw pixels */
-	if(qoip_read_header((u8*)opt.in, NULL, &desc)) {
+	if(qoip_read_header((u8*)opt.in, opt.in_len, NULL, &desc)) {
 		printf("Failed to read header\n");
 		return 1;
 	}
@@ -100,6 +100,9 @@ int main(int argc, char *argv[]) {
 	assert(scratch);
 
 	qoip_decode(opt.in, opt.in_len, &desc, desc.channels, raw, scratch);
+	desc.entropy_level = opt.level;
+	desc.entropy_threads = opt.threads;
+	desc.entropy_chunk = opt.chunk;
 
 	if(qoipcrunch_encode(raw, &desc, tmp, &tmp_len, opt.custom?opt.custom:effort_level, scratch, opt.threads, opt.entropy))
 		return 1;
@@ -92,8 +92,13 @@ int qoipcrunch_encode(const void *data, const qoip_desc *desc, void *out, size_t
 		necessary. Test effort -1 with no entropy, if result is large ZSTD encode and done*/
 		if( (ret = qoip_encode(data, desc, out, out_len, "0343444682", QOIP_ENTROPY_NONE, tmp)) )
 			return ret;
-		if(*out_len > 262144)/*threshold tuned with images/images-lance*/
-			qoip_entropy(out, out_len, tmp, QOIP_ENTROPY_ZSTD);
+		if(*out_len > 262144) {/*threshold tuned with images/images-lance*/
+			qoip_entropy_ctx_t ec = {0};
+			ec.level = desc->entropy_level;
+			ec.threads = desc->entropy_threads;
+			ec.chunk = desc->entropy_chunk;
+			qoip_entropy(out, out_len, tmp, QOIP_ENTROPY_ZSTD, &ec);
+		}
 		else if(level==0)
 			return qoip_encode(data, desc, out, out_len, "02244082a0a6c4c5e2", entropy, tmp);
 		else
@@ -106,25 +111,51 @@ int qoipcrunch_encode(const void *data, const qoip_desc *desc, void *out, size_t
 	return 0;
 }
 
+/* Candidates are encoded concurrently, each thread into its own qoip_maxsize
+slice of tmp. The best is tracked as a packed (size, candidate) pair so ties go
+to the earliest candidate like a serial search, then re-encoded into out */
+#define QOIP_CUSTOM_IDX_BITS 24
 int qoipcrunch_encode_custom(const void *data, const qoip_desc *desc, void *out, size_t *out_len, char *effort, void *tmp, int threads, int entropy) {
 	char *next_opstring, *combination_list = (*effort=='t') ? qoipcrunch_test : effort;
-	size_t working_cnt;
+	char **cand;
+	int i, cand_cnt, err=0;
+	size_t slice;
+	u64 best=-1;
 	if(strchr(combination_list, ',')==NULL)/*Escape hatch for single combinations*/
 		return qoip_encode(data, desc, out, out_len, combination_list, entropy, tmp);
-	next_opstring = combination_list-1;
-	*out_len=-1;
-	do {
-		++next_opstring;
-		if(qoip_encode(data, desc, tmp, &working_cnt, next_opstring, 0, NULL))
-			return 1;
-		if(*out_len>working_cnt) {/*copy best to out*/
-			memcpy(out, tmp, working_cnt);
-			*out_len = working_cnt;
+
+	cand_cnt = 1;
+	for(next_opstring=combination_list; (next_opstring=strchr(next_opstring, ',')); ++next_opstring)
+		++cand_cnt;
+	if(cand_cnt >= (1<<QOIP_CUSTOM_IDX_BITS))
+		return qoip_ret(1, stderr, "qoip_custom: Too many combinations");
+	if( !(cand = malloc(sizeof(char *)*cand_cnt)) )
+		return qoip_ret(1, stderr, "qoip_custom: Failed to allocate candidate list");
+	cand[0] = combination_list;
+	for(i=1;i<cand_cnt;++i)
+		cand[i] = strchr(cand[i-1], ',')+1;
+
+	threads = threads<1 ? 1 : (threads>QOIP_MAX_THREADS ? QOIP_MAX_THREADS : threads);
+	slice = qoip_maxsize(desc);
+	#pragma omp parallel for num_threads(threads) schedule(dynamic)
+	for(i=0;i<cand_cnt;++i) {
+		size_t working_cnt;
+		u64 curr, prev;
+		if(qoip_encode(data, desc, (u8 *)tmp + (omp_get_thread_num()*slice), &working_cnt, cand[i], 0, NULL)) {
+			__atomic_store_n(&err, 1, __ATOMIC_RELAXED);
+			continue;
 		}
-	} while( (next_opstring=strchr(next_opstring, ',')) );
-	if(entropy)
-		qoip_entropy(out, out_len, tmp, entropy);
-	return 0;
+		curr = ((u64)working_cnt<<QOIP_CUSTOM_IDX_BITS) | i;
+		prev = __atomic_load_n(&best, __ATOMIC_RELAXED);
+		while(curr<prev && !__atomic_compare_exchange_n(&best, &prev, curr, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+	if(err) {
+		free(cand);
+		return 1;
+	}
+	next_opstring = cand[best & ((1<<QOIP_CUSTOM_IDX_BITS)-1)];
+	free(cand);
+	return qoip_encode(data, desc, out, out_len, next_opstring, entropy, tmp);
 }
 
 /* Smarter function that doesn't use an ordered list of good combinations:
@@ -157,8 +188,9 @@ static size_t run_tot(size_t run1, size_t run2, size_t *run_short, size_t *run_l
 	return ret;
 }
 
+/* Log the current run, unless run_short is NULL in which case it is just reset */
 static inline void smart_encode_run(qoip_working_t *q, size_t *run_short, size_t **run_long, size_t *run_long_cnt, size_t *run_cap) {
-	if(q->run) {
+	if(q->run && run_short) {
 		if(q->run<=256)
 			++run_short[q->run-1];
 		else {
@@ -168,8 +200,8 @@ static inline void smart_encode_run(qoip_working_t *q, size_t *run_short, size_t
 			}
 			(*run_long)[(*run_long_cnt)++] = q->run;
 		}
-		q->run = 0;
 	}
+	q->run = 0;
 }
 
 /*Used whenever nop is selected from a set. Always returns false as a nop cannot encode anything*/
@@ -328,84 +360,29 @@ enum {STATOP_INDEX1_CNT=5, STATOP_RGB1_CNT=5, STATOP_RGBA1_CNT=2, STATOP_INDEX2_
 #define LUMALOG_INDEX_RGBA(a, b, c) (((a)*36)+(((b)-3)*6)+((c)-2))
 #define LUMALOG_INDEX_RGB(b, c)              ((((b)-3)*6)+((c)-2))
 
-int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out, size_t *out_len, int level, void *scratch, int threads, int entropy) {
+/* Stat pass over index1 ops [index1_lo, index1_hi) of the given level. Each index1
+op owns a disjoint slice of log_configs, so shards can run concurrently. Run
+stats only depend on the input and are gathered when run_short is non-NULL */
+static void qoipcrunch_smarter_stat(const void *data, const qoip_desc *desc, const int *rgba_cnts, int level, int entropy, int index1_lo, int index1_hi, logstat *log_configs, size_t *run_short, size_t **run_long, size_t *run_long_cnt, int *isrgb_out, int *use_a_out) {
 	int isrgb=-1, use_a=0;
-	size_t *run_long=NULL, run_cap=0, run_long_cnt=0, run_short[256] = {0}, run_lookup[256];
-
-	size_t i, j, comb, comb_cnt, explicit_cnt, best_cnt=-1, curr_cnt;
+	size_t run_cap=0;
 	qoip_working_t qq = {0};
 	qoip_working_t *q = &qq;
 	/*index1/2 constants*/
 	qoip_rgba_t index3[8]={0}, index4[16]={0}, index5[32]={0}, index6[64]={0}, index7[128]={0}, index8[256]={0}, index9[512]={0}, index10[1024]={0};
 	qoip_rgba_t *indexes1[5] = {index6, index5, index7, index4, index3}, *indexes2[3] = {index10, index9, index8};
-	const u8 statop_index2[] = {OP_INDEX10, OP_INDEX9, OP_INDEX8};
-	u8 statop_index1[] = {OP_INDEX6,  OP_INDEX5,  OP_INDEX7,  OP_INDEX4,  OP_INDEX3};
 	const int index1_mask[5] = {63, 31, 127, 15, 7}, index2_mask[3] = {1023, 511, 255};
 	int hashpos3[QOIP_FIFO_HASH_SIZE]={0}, hashpos4[QOIP_FIFO_HASH_SIZE]={0}, hashpos5[QOIP_FIFO_HASH_SIZE]={0}, hashpos6[QOIP_FIFO_HASH_SIZE]={0}, hashpos7[QOIP_FIFO_HASH_SIZE]={0};
 	int wpos[5]={0}, *hashpos[5] = {hashpos6, hashpos5, hashpos7, hashpos4, hashpos3 };
-	/*rgb1 constants*/
-	const u8 statop_rgb1[] = {OP_LUMA1_232B, OP_DIFF1_222, OP_DELTA, OP_LUMA1_232, OP_LUMA1_222};
+	/*delta1/2 simulations*/
 	int (*sim_delta1[]) (qoip_working_t *) = {qoip_sim_luma1_232b, qoip_sim_diff1_222, qoip_sim_delta, qoip_sim_luma1_232, qoip_sim_luma1_222};
 	int res_delta1[5];
-
-	const u8 statop_rgb2[] = {OP_LUMA2_464, OP_LUMA2_454, OP_LUMA2_555, OP_LUMA2_444,  OP_LUMA2_353,  OP_LUMA2_343,  OP_LUMA2_333, OP_LUMA2_242};
-	const u8 statop_rgb3[] = {OP_LUMA3_686, OP_LUMA3_676, OP_LUMA3_787, OP_LUMA3_575,  OP_LUMA3_565,  OP_LUMA3_666,  OP_LUMA3_777};
-
-	const u8 statop_rgba1[] = {255, OP_DELTAA};
 	int (*sim_delta2[]) (qoip_working_t *) = {qoip_false, qoip_sim_deltaa};
 	int res_delta2[2] = {0};
 
-	const u8 statop_rgba2[] = {255, OP_LUMA2_3433, OP_LUMA2_3533, OP_LUMA2_3534, OP_LUMA2_2322, OP_LUMA2_2422, OP_LUMA2_2423, OP_LUMA2_3432};
-	const u8 statop_rgba3[] = {255, OP_LUMA3_4543, OP_LUMA3_4544, OP_LUMA3_4644, OP_LUMA3_4645, OP_LUMA3_5654, OP_LUMA3_5655, OP_LUMA3_5755, OP_LUMA3_5756};
-	const u8 statop_rgba4[] = {255, OP_LUMA4_6866, OP_LUMA4_7876, OP_LUMA4_6766, OP_LUMA4_6765, OP_LUMA4_6867, OP_LUMA4_7877};
-	/*To guarantee that RGB input fed in as 3/4 channel is handled the same,
-	rgb_cnts has to mirror the equivalent values in rgba_cnts*/
-	int rgb_cnts[] = {
-		2, 2,    1, 2,    2,/*level 0*/
-		3, 4,    1, 4,    2,/*level 1*/
-		5, 4,    2, 5,    4,/*level 2*/
-		5, 4,    2, 6,    5,/*level 3*/
-		5, 5,    3, 7,    6,/*level 4*/
-		5, 5,    3, 8,    7,/*level 5*/
-	};
-	int rgba_cnts[] = {
-		2, 2, 2, 1, 2, 1, 2, 2, 2,/*level 0*/
-		3, 4, 2, 1, 4, 4, 2, 4, 4,/*level 1*/
-		5, 4, 2, 2, 5, 5, 4, 6, 5,/*level 2*/
-		5, 4, 2, 2, 6, 6, 5, 7, 6,/*level 3*/
-		5, 5, 2, 3, 7, 7, 6, 8, 7,/*level 4*/
-		5, 5, 2, 3, 8, 8, 7, 9, 7,/*level 5*/
-	};
-
-	/*statop sets in the order they should be tested*/
-	const u8* statops_rgb[] = {statop_index1, statop_rgb1, statop_index2, statop_rgb2, statop_rgb3};
-	const u8* statops_rgba[] = {statop_index1, statop_rgb1, statop_rgba1, statop_index2, statop_rgb2, statop_rgba2, statop_rgb3, statop_rgba3, statop_rgba4};
-	const int statops_rgb_cnt = 5, statops_rgba_cnt = 9;
-	const int rgb_lengths[] = {1, 1, 2, 2, 3};
-	const int rgba_lengths[] = {1, 1, 1, 2, 2, 2, 3, 3, 4};
-	u8 choice[12], best_choice[12]={0};
-	char opstr[32]={0};
-	/* sets* populated with rgb/rgba depending on input */
-	const u8 **sets;
-	int sets_cnt;
-	const int *set_cnts;
-	const int *set_lengths;
-
 	int log_g, log_r, log_b, log_rb, log_a, lumalog_loc;
-	logstat *log, log_configs[STATOP_CNT_MAX] = {0};
-
 	int it_index1, it_index2, it_delta1, it_delta2;
 
-	if ( data == NULL || desc == NULL || out == NULL || out_len == NULL ||
-		desc->width == 0 || desc->height == 0 ||
-		desc->channels < 3 || desc->channels > 4 || desc->colorspace > 1 )
-		return qoip_ret(1, stderr, "qoip_smarter: Bad arguments");
-
-	if(entropy==0) {//use FIFO instead of HASH for index1
-		for(i=0;i<5;++i)
-			++statop_index1[i];
-	}
-
 	qoip_init_working_memory(q, data, desc);
 	/* Stat pass */
 	q->px_pos = 0;
@@ -420,7 +397,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 				if (q->px.v == q->px_prev.v)
 					++q->run;
 				else {
-					smart_encode_run(q, run_short, &run_long, &run_long_cnt, &run_cap);
+					smart_encode_run(q, run_short, run_long, run_long_cnt, &run_cap);
 					q->hash = QOIP_COLOR_HASH(q->px);
 					qoip_gen_var_rgb(q);
 					log_r = log_lookup_2_8[q->avg_gr + 128];
@@ -431,7 +408,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 					for(it_delta1=0;it_delta1<rgba_cnts[(level*9)+1];++it_delta1)
 						res_delta1[it_delta1] = sim_delta1[it_delta1](q);
 					if(entropy) {//HASH index1
-						for(it_index1=0;it_index1<rgba_cnts[(level*9)+0];++it_index1) {
+						for(it_index1=index1_lo;it_index1<index1_hi;++it_index1) {
 							if(indexes1[it_index1][q->hash & index1_mask[it_index1]].v == q->px.v) {
 								for(it_delta1=0;it_delta1<rgba_cnts[(level*9)+1];++it_delta1) {
 									for(it_index2=0;it_index2<rgba_cnts[(level*9)+3];++it_index2) {
@@ -464,7 +441,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 						}
 					}
 					else {//FIFO index1
-						for(it_index1=0;it_index1<rgba_cnts[(level*9)+0];++it_index1) {//index1F
+						for(it_index1=index1_lo;it_index1<index1_hi;++it_index1) {//index1F
 							if(indexes1[it_index1][hashpos[it_index1][q->hash & (QOIP_FIFO_HASH_SIZE - 1)] & index1_mask[it_index1]].v == q->px.v) {
 								for(it_delta1=0;it_delta1<rgba_cnts[(level*9)+1];++it_delta1) {
 									for(it_index2=0;it_index2<rgba_cnts[(level*9)+3];++it_index2) {
@@ -500,11 +477,6 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 					for(it_index2=0;it_index2<rgba_cnts[(level*9)+3];++it_index2)
 						indexes2[it_index2][q->hash & index2_mask[it_index2]] = q->px;
 				}
-				if(q->px_w<8192) {
-					q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-					q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-					q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-				}
 				q->px_pos += 3;
 			}
 		}
@@ -517,7 +489,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 				if (q->px.v == q->px_prev.v)
 					++q->run;
 				else {
-					smart_encode_run(q, run_short, &run_long, &run_long_cnt, &run_cap);
+					smart_encode_run(q, run_short, run_long, run_long_cnt, &run_cap);
 					q->hash = QOIP_COLOR_HASH(q->px);
 					qoip_gen_var_rgb(q);
 					log_r = log_lookup_2_8[q->avg_gr + 128];
@@ -533,7 +505,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 						res_delta1[it_delta1] = sim_delta1[it_delta1](q);
 					res_delta2[1] = sim_delta2[1](q);
 					if(entropy) {//HASH index1
-						for(it_index1=0;it_index1<rgba_cnts[(level*9)+0];++it_index1) {//index1H
+						for(it_index1=index1_lo;it_index1<index1_hi;++it_index1) {//index1H
 							if(indexes1[it_index1][q->hash & index1_mask[it_index1]].v == q->px.v) {
 								for(it_delta1=0;it_delta1<rgba_cnts[(level*9)+1];++it_delta1) {
 									for(it_delta2=0;it_delta2<rgba_cnts[(level*9)+2];++it_delta2) {
@@ -586,7 +558,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 						}
 					}
 					else {//FIFO index1
-						for(it_index1=0;it_index1<rgba_cnts[(level*9)+0];++it_index1) {//index1F
+						for(it_index1=index1_lo;it_index1<index1_hi;++it_index1) {//index1F
 							if(indexes1[it_index1][hashpos[it_index1][q->hash & (QOIP_FIFO_HASH_SIZE - 1)] & index1_mask[it_index1]].v == q->px.v) {
 								for(it_delta1=0;it_delta1<rgba_cnts[(level*9)+1];++it_delta1) {
 									for(it_delta2=0;it_delta2<rgba_cnts[(level*9)+2];++it_delta2) {
@@ -642,16 +614,93 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 					for(it_index2=0;it_index2<rgba_cnts[(level*9)+3];++it_index2)
 						indexes2[it_index2][q->hash & index2_mask[it_index2]] = q->px;
 				}
-				if(q->px_w<8192) {
-					q->upcache[(q->px_w * 3) + 0] = q->px.rgba.r;
-					q->upcache[(q->px_w * 3) + 1] = q->px.rgba.g;
-					q->upcache[(q->px_w * 3) + 2] = q->px.rgba.b;
-				}
 				q->px_pos += 4;
 			}
 		}
 	}
-	smart_encode_run(q, run_short, &run_long, &run_long_cnt, &run_cap);/*Cap last run*/
+	smart_encode_run(q, run_short, run_long, run_long_cnt, &run_cap);/*Cap last run*/
+	*isrgb_out = isrgb;
+	*use_a_out = use_a;
+}
+
+int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out, size_t *out_len, int level, void *scratch, int threads, int entropy) {
+	int isrgb=-1, use_a=0;
+	size_t *run_long=NULL, run_long_cnt=0, run_short[256] = {0}, run_lookup[256];
+
+	size_t i, j, comb_cnt, best_cnt=-1, best_i=-1;
+	const u8 statop_index2[] = {OP_INDEX10, OP_INDEX9, OP_INDEX8};
+	u8 statop_index1[] = {OP_INDEX6,  OP_INDEX5,  OP_INDEX7,  OP_INDEX4,  OP_INDEX3};
+	/*rgb1 constants*/
+	const u8 statop_rgb1[] = {OP_LUMA1_232B, OP_DIFF1_222, OP_DELTA, OP_LUMA1_232, OP_LUMA1_222};
+
+	const u8 statop_rgb2[] = {OP_LUMA2_464, OP_LUMA2_454, OP_LUMA2_555, OP_LUMA2_444,  OP_LUMA2_353,  OP_LUMA2_343,  OP_LUMA2_333, OP_LUMA2_242};
+	const u8 statop_rgb3[] = {OP_LUMA3_686, OP_LUMA3_676, OP_LUMA3_787, OP_LUMA3_575,  OP_LUMA3_565,  OP_LUMA3_666,  OP_LUMA3_777};
+
+	const u8 statop_rgba1[] = {255, OP_DELTAA};
+
+	const u8 statop_rgba2[] = {255, OP_LUMA2_3433, OP_LUMA2_3533, OP_LUMA2_3534, OP_LUMA2_2322, OP_LUMA2_2422, OP_LUMA2_2423, OP_LUMA2_3432};
+	const u8 statop_rgba3[] = {255, OP_LUMA3_4543, OP_LUMA3_4544, OP_LUMA3_4644, OP_LUMA3_4645, OP_LUMA3_5654, OP_LUMA3_5655, OP_LUMA3_5755, OP_LUMA3_5756};
+	const u8 statop_rgba4[] = {255, OP_LUMA4_6866, OP_LUMA4_7876, OP_LUMA4_6766, OP_LUMA4_6765, OP_LUMA4_6867, OP_LUMA4_7877};
+	/*To guarantee that RGB input fed in as 3/4 channel is handled the same,
+	rgb_cnts has to mirror the equivalent values in rgba_cnts*/
+	int rgb_cnts[] = {
+		2, 2,    1, 2,    2,/*level 0*/
+		3, 4,    1, 4,    2,/*level 1*/
+		5, 4,    2, 5,    4,/*level 2*/
+		5, 4,    2, 6,    5,/*level 3*/
+		5, 5,    3, 7,    6,/*level 4*/
+		5, 5,    3, 8,    7,/*level 5*/
+	};
+	int rgba_cnts[] = {
+		2, 2, 2, 1, 2, 1, 2, 2, 2,/*level 0*/
+		3, 4, 2, 1, 4, 4, 2, 4, 4,/*level 1*/
+		5, 4, 2, 2, 5, 5, 4, 6, 5,/*level 2*/
+		5, 4, 2, 2, 6, 6, 5, 7, 6,/*level 3*/
+		5, 5, 2, 3, 7, 7, 6, 8, 7,/*level 4*/
+		5, 5, 2, 3, 8, 8, 7, 9, 7,/*level 5*/
+	};
+
+	/*statop sets in the order they should be tested*/
+	const u8* statops_rgb[] = {statop_index1, statop_rgb1, statop_index2, statop_rgb2, statop_rgb3};
+	const u8* statops_rgba[] = {statop_index1, statop_rgb1, statop_rgba1, statop_index2, statop_rgb2, statop_rgba2, statop_rgb3, statop_rgba3, statop_rgba4};
+	const int statops_rgb_cnt = 5, statops_rgba_cnt = 9;
+	const int rgb_lengths[] = {1, 1, 2, 2, 3};
+	const int rgba_lengths[] = {1, 1, 1, 2, 2, 2, 3, 3, 4};
+	u8 best_choice[12]={0};
+	char opstr[32]={0};
+	/* sets* populated with rgb/rgba depending on input */
+	const u8 **sets;
+	int sets_cnt;
+	const int *set_cnts;
+	const int *set_lengths;
+
+	logstat log_configs[STATOP_CNT_MAX] = {0};
+
+	if ( data == NULL || desc == NULL || out == NULL || out_len == NULL ||
+		desc->width == 0 || desc->height == 0 ||
+		desc->channels < 3 || desc->channels > 4 || desc->colorspace > 1 )
+		return qoip_ret(1, stderr, "qoip_smarter: Bad arguments");
+
+	if(entropy==0) {//use FIFO instead of HASH for index1
+		for(i=0;i<5;++i)
+			++statop_index1[i];
+	}
+	threads = threads<1 ? 1 : (threads>QOIP_MAX_THREADS ? QOIP_MAX_THREADS : threads);
+
+	/* Stat pass, sharded over the index1 set. Shard 0 also gathers run stats */
+	{
+		int s, shards, index1_cnt = rgba_cnts[(level*9)+0];
+		int shard_isrgb[STATOP_INDEX1_CNT], shard_use_a[STATOP_INDEX1_CNT];
+		shards = threads<index1_cnt ? threads : index1_cnt;
+		#pragma omp parallel for num_threads(shards) schedule(static, 1)
+		for(s=0;s<shards;++s)
+			qoipcrunch_smarter_stat(data, desc, rgba_cnts, level, entropy,
+				(s*index1_cnt)/shards, ((s+1)*index1_cnt)/shards, log_configs,
+				s ? NULL : run_short, &run_long, &run_long_cnt, shard_isrgb+s, shard_use_a+s);
+		isrgb = shard_isrgb[0];
+		for(s=0;s<shards;++s)
+			use_a |= shard_use_a[s];
+	}
 
 	/*Determine if 4 channel input is RGB or RGBA*/
 	isrgb = (isrgb == -1 ? 1 : isrgb);
@@ -666,121 +715,141 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 		sets_cnt = statops_rgb_cnt;
 		set_cnts = rgb_cnts+(level*sets_cnt);
 		set_lengths = rgb_lengths;
-		comb_cnt = 1;
-		for(i=0;i<sets_cnt;++i)
-			comb_cnt *= set_cnts[i];
-		for(i=0;i<comb_cnt;++i) {
-			int cindex[12];/*index of the current choice*/
-			/*Choose ops from sets*/
-			comb=i;
-			for(j=0;j<sets_cnt;++j) {
-				cindex[j]=comb%set_cnts[j];
-				choice[j] = sets[j][comb%set_cnts[j]];
-				comb /= set_cnts[j];
-			}
-
-			/*Find explicit length*/
-			explicit_cnt = 0;
-			for(j=0;j<sets_cnt;++j)
-				explicit_cnt += QOIP_OPCNT(choice[j]);
-			if(explicit_cnt<192 || explicit_cnt>253)
-				continue;
-
-			/*Test combination*/
-			{
-				int g, r, oplog[12];
-				log = log_configs + LOGSTAT_INDEX_RGB(cindex[0], cindex[1], cindex[2]);
-				curr_cnt = run_lookup[256-(explicit_cnt+3)] + log->base_size;
-				oplog[3] = op_log_lookup[choice[3]];
-				oplog[4] = op_log_lookup[choice[4]];
-				for(g=3;g<=8;++g) {
-					for(r=2;r<=7;++r) {
-						if( r<=(oplog[3]&15) && g<=((oplog[3]>>4)&15) )
-							curr_cnt += (set_lengths[3]*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
-						else if( r<=(oplog[4]&15) && g<=((oplog[4]>>4)&15) )
-							curr_cnt += (set_lengths[4]*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
-						else
-							curr_cnt += (4*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
-					}
-				}
-			}
-
-			if(best_cnt>curr_cnt) {
-				best_cnt=curr_cnt;
-				for(j=0;j<sets_cnt;++j)
-					best_choice[j]=choice[j];
-			}
-		}
 	}
 	else {/*RGBA*/
 		sets = statops_rgba;
 		sets_cnt = statops_rgba_cnt;
 		set_cnts = rgba_cnts+(level*sets_cnt);
 		set_lengths = rgba_lengths;
-		comb_cnt = 1;
-		for(i=0;i<sets_cnt;++i)
-			comb_cnt *= set_cnts[i];
-		for(i=0;i<comb_cnt;++i) {
-			int cindex[12];/*index of the current choice*/
-			/*Choose ops from sets*/
-			comb=i;
-			for(j=0;j<sets_cnt;++j) {
-				cindex[j]=comb%set_cnts[j];
-				choice[j] = sets[j][comb%set_cnts[j]];
-				comb /= set_cnts[j];
-			}
-			/*Find explicit length*/
-			explicit_cnt = use_a;
-			for(j=0;j<sets_cnt;++j) {
-				if(choice[j]!=255)
+	}
+	comb_cnt = 1;
+	for(i=0;i<sets_cnt;++i)
+		comb_cnt *= set_cnts[i];
+	/* Each thread keeps its own best, the lowest combination index wins ties so
+	the result matches a serial search */
+	#pragma omp parallel num_threads(threads)
+	{
+		size_t j, comb, explicit_cnt, curr_cnt, t_best_cnt=-1, t_best_i=0;
+		u8 choice[12], t_best_choice[12]={0};
+		logstat *log;
+		if(isrgb) {
+			#pragma omp for schedule(dynamic, 1024)
+			for(i=0;i<comb_cnt;++i) {
+				int cindex[12];/*index of the current choice*/
+				/*Choose ops from sets*/
+				comb=i;
+				for(j=0;j<sets_cnt;++j) {
+					cindex[j]=comb%set_cnts[j];
+					choice[j] = sets[j][comb%set_cnts[j]];
+					comb /= set_cnts[j];
+				}
+
+				/*Find explicit length*/
+				explicit_cnt = 0;
+				for(j=0;j<sets_cnt;++j)
 					explicit_cnt += QOIP_OPCNT(choice[j]);
-			}
-			if(explicit_cnt<192 || explicit_cnt>253)
-				continue;
-
-			/*Test combination*/
-			{
-				int a, g, r, oplog[12];
-				log = log_configs + LOGSTAT_INDEX_RGBA(cindex[2], cindex[0], cindex[1], cindex[3]);
-				curr_cnt = run_lookup[256-(explicit_cnt+3)] + log->base_size;
-				for(j=4;j<sets_cnt;++j)
-					oplog[j] = op_log_lookup[choice[j]];
-				{/*a=0*/
+				if(explicit_cnt<192 || explicit_cnt>253)
+					continue;
+
+				/*Test combination*/
+				{
+					int g, r, oplog[12];
+					log = log_configs + LOGSTAT_INDEX_RGB(cindex[0], cindex[1], cindex[2]);
+					curr_cnt = run_lookup[256-(explicit_cnt+3)] + log->base_size;
+					oplog[3] = op_log_lookup[choice[3]];
+					oplog[4] = op_log_lookup[choice[4]];
 					for(g=3;g<=8;++g) {
 						for(r=2;r<=7;++r) {
-							for(j=4;j<sets_cnt;++j) {
-								if( r<=(oplog[j]&15) && g<=((oplog[j]>>4)&15) ) {
-									curr_cnt += (set_lengths[j]*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
-									break;
-								}
-							}
-							if(j==sets_cnt)
+							if( r<=(oplog[3]&15) && g<=((oplog[3]>>4)&15) )
+								curr_cnt += (set_lengths[3]*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
+							else if( r<=(oplog[4]&15) && g<=((oplog[4]>>4)&15) )
+								curr_cnt += (set_lengths[4]*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
+							else
 								curr_cnt += (4*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
 						}
 					}
 				}
-				for(a=2;a<=7;++a) {
-					for(g=3;g<=8;++g) {
-						for(r=2;r<=7;++r) {
-							if(      r<=(oplog[5]&15) && g<=((oplog[5]>>4)&15) && a<=((oplog[5]>>8)&15) )
-								curr_cnt += (set_lengths[5]*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
-							else if( r<=(oplog[7]&15) && g<=((oplog[7]>>4)&15) && a<=((oplog[7]>>8)&15) )
-								curr_cnt += (set_lengths[7]*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
-							else if( r<=(oplog[8]&15) && g<=((oplog[8]>>4)&15) && a<=((oplog[8]>>8)&15) )
-								curr_cnt += (set_lengths[8]*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
-							else
-								curr_cnt += (5*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
+
+				if(t_best_cnt>curr_cnt) {
+					t_best_cnt=curr_cnt;
+					t_best_i=i;
+					for(j=0;j<sets_cnt;++j)
+						t_best_choice[j]=choice[j];
+				}
+			}
+		}
+		else {/*RGBA*/
+			#pragma omp for schedule(dynamic, 1024)
+			for(i=0;i<comb_cnt;++i) {
+				int cindex[12];/*index of the current choice*/
+				/*Choose ops from sets*/
+				comb=i;
+				for(j=0;j<sets_cnt;++j) {
+					cindex[j]=comb%set_cnts[j];
+					choice[j] = sets[j][comb%set_cnts[j]];
+					comb /= set_cnts[j];
+				}
+				/*Find explicit length*/
+				explicit_cnt = use_a;
+				for(j=0;j<sets_cnt;++j) {
+					if(choice[j]!=255)
+						explicit_cnt += QOIP_OPCNT(choice[j]);
+				}
+				if(explicit_cnt<192 || explicit_cnt>253)
+					continue;
+
+				/*Test combination*/
+				{
+					int a, g, r, oplog[12];
+					log = log_configs + LOGSTAT_INDEX_RGBA(cindex[2], cindex[0], cindex[1], cindex[3]);
+					curr_cnt = run_lookup[256-(explicit_cnt+3)] + log->base_size;
+					for(j=4;j<sets_cnt;++j)
+						oplog[j] = op_log_lookup[choice[j]];
+					{/*a=0*/
+						for(g=3;g<=8;++g) {
+							for(r=2;r<=7;++r) {
+								for(j=4;j<sets_cnt;++j) {
+									if( r<=(oplog[j]&15) && g<=((oplog[j]>>4)&15) ) {
+										curr_cnt += (set_lengths[j]*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
+										break;
+									}
+								}
+								if(j==sets_cnt)
+									curr_cnt += (4*log->lumalog[LUMALOG_INDEX_RGB(g, r)]);
+							}
+						}
+					}
+					for(a=2;a<=7;++a) {
+						for(g=3;g<=8;++g) {
+							for(r=2;r<=7;++r) {
+								if(      r<=(oplog[5]&15) && g<=((oplog[5]>>4)&15) && a<=((oplog[5]>>8)&15) )
+									curr_cnt += (set_lengths[5]*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
+								else if( r<=(oplog[7]&15) && g<=((oplog[7]>>4)&15) && a<=((oplog[7]>>8)&15) )
+									curr_cnt += (set_lengths[7]*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
+								else if( r<=(oplog[8]&15) && g<=((oplog[8]>>4)&15) && a<=((oplog[8]>>8)&15) )
+									curr_cnt += (set_lengths[8]*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
+								else
+									curr_cnt += (5*log->lumalog[LUMALOG_INDEX_RGBA(a, g, r)]);
+							}
 						}
 					}
 				}
-			}
 
-			if(best_cnt>curr_cnt) {
-				best_cnt=curr_cnt;
-				for(j=0;j<sets_cnt;++j)
-					best_choice[j]=choice[j];
+				if(t_best_cnt>curr_cnt) {
+					t_best_cnt=curr_cnt;
+					t_best_i=i;
+					for(j=0;j<sets_cnt;++j)
+						t_best_choice[j]=choice[j];
+				}
 			}
 		}
+		#pragma omp critical
+		if(best_cnt>t_best_cnt || (best_cnt==t_best_cnt && best_i>t_best_i)) {
+			best_cnt=t_best_cnt;
+			best_i=t_best_i;
+			for(j=0;j<sets_cnt;++j)
+				best_choice[j]=t_best_choice[j];
+		}
 	}
 
 	{/*Build best opstring*/
@@ -808,7 +877,7 @@ int qoipcrunch_encode_smarter(const void *data, const qoip_desc *desc, void *out
 		ret = qoip_encode(data, desc, out, out_len, opstr, entropy, scratch);
 		if(entropy) {//Check size of raw bitstream TODO
 		}
-		else
+		else if(!desc->strip_height)/* Strips reset state so the estimate is inexact */
 			assert(*out_len == best_cnt);
 		return ret;
 	}
@@ -73,7 +73,7 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
-	qoip_stat(opt.in, stdout);
+	qoip_stat(opt.in, opt.in_len, stdout);
 
 	return 0;
 }